@@ -0,0 +1,317 @@
+/*
+ * mallocbench.cpp
+ *
+ * Single threaded benchmark which compares first fit (with each of its
+ * search policies), buddy and the malloc of the C library on synthetic
+ * workloads. A workload is a size distribution and a free order:
+ *
+ *      sizes   fixed (64 bytes), uniform (16 B - 4 KiB) or powerlaw (Pareto
+ *              distributed, 16 B - 64 KiB, mostly small)
+ *      order   lifo (the last allocated block is freed first), fifo or
+ *              random
+ *
+ * Every round allocates `blocks` blocks and then frees all of them in the
+ * given order. The sizes and the orders are generated before the clock is
+ * started. The workload runs twice: once timed as a whole for the
+ * throughput and once with every operation timed for the latencies (the
+ * clock costs some nanoseconds, so they are a bit high).
+ *
+ * Each configuration runs in its own process because the algorithm can
+ * only be set once, and so the peak RSS of one does not hide the next.
+ * The overhead is the growth of the RSS divided by the peak of the live
+ * requested bytes (1.00 means no overhead at all).
+ *
+ * usage: mallocbench [-a allocator] [-s sizes] [-o order] [-n blocks] [-r rounds]
+ *
+ * Without -a, -s or -o every value is run. The results are printed as CSV:
+ *      allocator,sizes,order,ops_per_sec,p50_ns,p99_ns,p999_ns,peak_rss_kb,peak_live_kb,overhead
+ */
+
+#include "myalloc.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#define FIXED_SIZE 64
+#define UNIFORM_MIN 16
+#define UNIFORM_MAX 4096
+#define POWERLAW_MIN 16
+#define POWERLAW_MAX 65536
+#define POWERLAW_ALPHA 1.2
+
+struct result {
+    double ops_per_sec;
+    long p50_ns;
+    long p99_ns;
+    long p999_ns;
+    long peak_rss_kb;
+    long peak_live_kb;
+    double overhead;
+};
+
+static void* glibc_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+static void* myalloc_malloc(size_t size)
+{
+    /* like malloc, the block does not need to be filled */
+    return my_malloc(size, NO_FILL);
+}
+
+/* returns the sizes of `rounds` rounds of `blocks` requests */
+static std::vector<size_t> make_sizes(const char *sizes, long blocks, long rounds)
+{
+    std::vector<size_t> result(blocks * rounds);
+    unsigned seed = 1;
+    for (size_t &size : result)
+    {
+        if (strcmp(sizes, "fixed") == 0)
+        {
+            size = FIXED_SIZE;
+        } else if (strcmp(sizes, "uniform") == 0)
+        {
+            size = UNIFORM_MIN + rand_r(&seed) % (UNIFORM_MAX - UNIFORM_MIN + 1);
+        } else {
+            double u = (rand_r(&seed) + 1.0) / (RAND_MAX + 1.0);
+            double s = POWERLAW_MIN / pow(u, 1 / POWERLAW_ALPHA);
+            size = s > POWERLAW_MAX ? POWERLAW_MAX : (size_t) s;
+        }
+    }
+    return result;
+}
+
+/* returns the order in which the blocks of a round are freed */
+static std::vector<long> make_order(const char *order, long blocks)
+{
+    std::vector<long> result(blocks);
+    for (long i = 0; i < blocks; i++)
+    {
+        result[i] = strcmp(order, "lifo") == 0 ? blocks - 1 - i : i;
+    }
+    if (strcmp(order, "random") == 0)
+    {
+        unsigned seed = 2;
+        for (long i = blocks - 1; i > 0; i--)
+        {
+            std::swap(result[i], result[rand_r(&seed) % (i + 1)]);
+        }
+    }
+    return result;
+}
+
+static inline long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* returns the resident set size of the process in KiB */
+static long current_rss_kb()
+{
+    long size = 0, pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL)
+    {
+        // the first field is the total size, the second one is resident
+        if (fscanf(statm, "%ld %ld", &size, &pages) != 2)
+            pages = 0;
+        fclose(statm);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* runs one configuration */
+static struct result run(const char *allocator, const char *sizes, const char *order,
+                         long blocks, long rounds)
+{
+    void *(*alloc)(size_t) = &myalloc_malloc;
+    void (*release)(void *) = &my_free;
+    if (strcmp(allocator, "glibc") == 0)
+    {
+        alloc = &glibc_malloc;
+        release = &free;
+    } else {
+        set_algorithm(allocator);
+    }
+
+    std::vector<size_t> requests = make_sizes(sizes, blocks, rounds);
+    std::vector<long> frees = make_order(order, blocks);
+    std::vector<char *> live(blocks);
+    std::vector<long> latencies(2 * blocks * rounds);
+
+    struct result result = {};
+    for (long r = 0; r < rounds; r++)
+    {
+        long live_bytes = 0;
+        for (long i = 0; i < blocks; i++)
+            live_bytes += requests[r * blocks + i];
+        result.peak_live_kb = std::max(result.peak_live_kb, live_bytes / 1024);
+    }
+    long base_rss = current_rss_kb();
+
+    auto start = std::chrono::steady_clock::now();
+    for (long r = 0; r < rounds; r++)
+    {
+        for (long i = 0; i < blocks; i++)
+        {
+            live[i] = (char *) alloc(requests[r * blocks + i]);
+            live[i][0] = 1;
+        }
+        for (long i = 0; i < blocks; i++)
+        {
+            release(live[frees[i]]);
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    result.ops_per_sec = 2.0 * blocks * rounds / elapsed.count();
+
+    long *latency = latencies.data();
+    for (long r = 0; r < rounds; r++)
+    {
+        for (long i = 0; i < blocks; i++)
+        {
+            long begin = now_ns();
+            live[i] = (char *) alloc(requests[r * blocks + i]);
+            *latency++ = now_ns() - begin;
+            live[i][0] = 1;
+        }
+        for (long i = 0; i < blocks; i++)
+        {
+            long begin = now_ns();
+            release(live[frees[i]]);
+            *latency++ = now_ns() - begin;
+        }
+    }
+
+    size_t count = latencies.size();
+    std::sort(latencies.begin(), latencies.end());
+    result.p50_ns = latencies[count / 2];
+    result.p99_ns = latencies[count * 99 / 100];
+    result.p999_ns = latencies[count * 999 / 1000];
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    result.peak_rss_kb = usage.ru_maxrss;
+    result.overhead = result.peak_live_kb > 0
+        ? (double) (usage.ru_maxrss - base_rss) / result.peak_live_kb : 0;
+    return result;
+}
+
+/* runs one configuration in a child process */
+static int run_isolated(const char *allocator, const char *sizes, const char *order,
+                        long blocks, long rounds, struct result *result)
+{
+    int fds[2];
+    if (pipe(fds) == -1)
+    {
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        struct result r = run(allocator, sizes, order, blocks, rounds);
+        if (write(fds[1], &r, sizeof(r)) != sizeof(r))
+            _exit(1);
+        _exit(0);
+    }
+
+    int status = 0;
+    close(fds[1]);
+    if (pid == -1 || read(fds[0], result, sizeof(*result)) != sizeof(*result))
+    {
+        status = -1;
+    }
+    close(fds[0]);
+    if (pid != -1)
+    {
+        waitpid(pid, NULL, 0);
+    }
+    return status;
+}
+
+/* returns whether value is one of the names (NULL ends the list) */
+static bool is_one_of(const char *value, const char *const *names)
+{
+    for (; *names != NULL; names++)
+    {
+        if (strcmp(value, *names) == 0)
+            return true;
+    }
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *const allocators[] = {"firstfit", "bestfit", "nextfit", "addressfit",
+                                             "buddy", "glibc", NULL};
+    static const char *const distributions[] = {"fixed", "uniform", "powerlaw", NULL};
+    static const char *const orders[] = {"lifo", "fifo", "random", NULL};
+
+    const char *only_allocator = NULL, *only_sizes = NULL, *only_order = NULL;
+    long blocks = 10000, rounds = 10;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:s:o:n:r:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a': only_allocator = optarg; break;
+        case 's': only_sizes = optarg; break;
+        case 'o': only_order = optarg; break;
+        case 'n': blocks = atol(optarg); break;
+        case 'r': rounds = atol(optarg); break;
+        default: blocks = 0;
+        }
+    }
+    if (blocks < 1 || rounds < 1 || optind != argc
+        || (only_allocator != NULL && !is_one_of(only_allocator, allocators))
+        || (only_sizes != NULL && !is_one_of(only_sizes, distributions))
+        || (only_order != NULL && !is_one_of(only_order, orders)))
+    {
+        fprintf(stderr, "usage: %s [-a firstfit|bestfit|nextfit|addressfit|buddy|glibc] "
+                "[-s fixed|uniform|powerlaw] "
+                "[-o lifo|fifo|random] [-n blocks] [-r rounds]\n", argv[0]);
+        return 1;
+    }
+
+    printf("allocator,sizes,order,ops_per_sec,p50_ns,p99_ns,p999_ns,"
+           "peak_rss_kb,peak_live_kb,overhead\n");
+    for (const char *const *allocator = allocators; *allocator != NULL; allocator++)
+    {
+        if (only_allocator != NULL && strcmp(*allocator, only_allocator) != 0)
+            continue;
+        for (const char *const *sizes = distributions; *sizes != NULL; sizes++)
+        {
+            if (only_sizes != NULL && strcmp(*sizes, only_sizes) != 0)
+                continue;
+            for (const char *const *order = orders; *order != NULL; order++)
+            {
+                if (only_order != NULL && strcmp(*order, only_order) != 0)
+                    continue;
+                struct result r;
+                if (run_isolated(*allocator, *sizes, *order, blocks, rounds, &r) == -1)
+                {
+                    fprintf(stderr, "%s,%s,%s failed\n", *allocator, *sizes, *order);
+                    continue;
+                }
+                printf("%s,%s,%s,%.0f,%ld,%ld,%ld,%ld,%ld,%.2f\n", *allocator, *sizes,
+                       *order, r.ops_per_sec, r.p50_ns, r.p99_ns, r.p999_ns,
+                       r.peak_rss_kb, r.peak_live_kb, r.overhead);
+                fflush(stdout);
+            }
+        }
+    }
+    return 0;
+}
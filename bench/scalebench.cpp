@@ -0,0 +1,136 @@
+/*
+ * scalebench.cpp
+ *
+ * Stress benchmark which shows how my_malloc/my_free scale from 1 to N
+ * threads with a single arena and with one arena per thread.
+ *
+ * Every thread keeps a window of live blocks and replaces a random one in
+ * each step, with sizes up to 8 KiB so most requests miss the thread cache
+ * and reach the arenas. Each configuration runs in its own process because
+ * the algorithm and the arena count can only be set once.
+ *
+ * usage: scalebench [max_threads] [operations_per_thread]
+ *
+ * The results are printed as CSV:
+ *      algorithm,arenas,threads,ops_per_sec,speedup
+ */
+
+#include "myalloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#define WINDOW 256
+#define MAX_SIZE 8192
+
+static void worker(unsigned seed, long operations)
+{
+    void *blocks[WINDOW] = {0};
+    for (long i = 0; i < operations; i++)
+    {
+        int slot = rand_r(&seed) % WINDOW;
+        my_free(blocks[slot]);
+        blocks[slot] = my_malloc(1 + rand_r(&seed) % MAX_SIZE, 0);
+    }
+    for (int slot = 0; slot < WINDOW; slot++)
+    {
+        my_free(blocks[slot]);
+    }
+}
+
+/* runs one configuration and returns the number of operations per second */
+static double run(const char *algorithm, int arenas, int threads, long operations)
+{
+    set_algorithm(algorithm);
+    set_arenas(arenas);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; i++)
+    {
+        pool.emplace_back(worker, i + 1, operations);
+    }
+    for (auto &t : pool)
+    {
+        t.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    /* each step is one malloc and one free */
+    return 2.0 * operations * threads / elapsed.count();
+}
+
+/* runs one configuration in a child process */
+static double run_isolated(const char *algorithm, int arenas, int threads, long operations)
+{
+    int fds[2];
+    if (pipe(fds) == -1)
+    {
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        double result = run(algorithm, arenas, threads, operations);
+        if (write(fds[1], &result, sizeof(result)) != sizeof(result))
+            _exit(1);
+        _exit(0);
+    }
+
+    double result = -1;
+    close(fds[1]);
+    if (pid == -1 || read(fds[0], &result, sizeof(result)) != sizeof(result))
+    {
+        result = -1;
+    }
+    close(fds[0]);
+    if (pid != -1)
+    {
+        waitpid(pid, NULL, 0);
+    }
+    return result;
+}
+
+int main(int argc, char const *argv[])
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+    long operations = argc > 2 ? atol(argv[2]) : 200000;
+    if (max_threads < 1 || operations < 1)
+    {
+        fprintf(stderr, "usage: %s [max_threads] [operations_per_thread]\n", argv[0]);
+        return 1;
+    }
+
+    const char *algorithms[] = {"firstfit", "buddy"};
+    printf("algorithm,arenas,threads,ops_per_sec,speedup\n");
+    for (const char *algorithm : algorithms)
+    {
+        int arena_counts[] = {1, max_threads};
+        for (int c = 0; c < (max_threads > 1 ? 2 : 1); c++)
+        {
+            double base = 0;
+            for (int threads = 1; threads <= max_threads; threads *= 2)
+            {
+                double ops = run_isolated(algorithm, arena_counts[c], threads, operations);
+                if (threads == 1)
+                {
+                    base = ops;
+                }
+                printf("%s,%d,%d,%.0f,%.2f\n", algorithm, arena_counts[c], threads,
+                       ops, base > 0 ? ops / base : 0);
+                fflush(stdout);
+                if (threads < max_threads && threads * 2 > max_threads)
+                {
+                    threads = max_threads / 2;
+                }
+            }
+        }
+    }
+    return 0;
+}
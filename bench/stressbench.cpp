@@ -0,0 +1,417 @@
+/*
+ * stressbench.cpp
+ *
+ * Ports of the classic multithreaded allocator benchmarks. They run against
+ * first fit and buddy (through my_malloc/my_free) and against the malloc of
+ * the C library for comparison:
+ *
+ *      larson          server simulation: threads replace random blocks of
+ *                      their slots, and every epoch the slots are handed
+ *                      to a new thread, which frees blocks of another one
+ *      threadtest      every thread allocates a batch of small blocks and
+ *                      frees all of them, again and again
+ *      cache-scratch   passive false sharing: every thread frees a small
+ *                      block allocated by the main thread, then allocates,
+ *                      writes and frees small blocks
+ *      cache-thrash    active false sharing: every thread allocates, writes
+ *                      and frees small blocks
+ *      xmalloc         producer/consumer: half of the threads allocate and
+ *                      the other half free (every free is remote)
+ *      mstress         random allocations and frees of mixed sizes where
+ *                      some blocks move to other threads through a shared
+ *                      array before they are freed
+ *
+ * Each configuration runs in its own process because the algorithm and the
+ * arena count can only be set once, and so the peak RSS (which shows the
+ * blowup) belongs to a single run.
+ *
+ * usage: stressbench [-b benchmark] [-a allocator] [-t threads] [-A arenas] [-s scale]
+ *
+ * `threads` defaults to the number of online CPUs, `arenas` to 1 and the
+ * work of every benchmark is multiplied by `scale` (1 by default). The
+ * results are printed as CSV:
+ *      benchmark,allocator,arenas,threads,seconds,ops_per_sec,peak_rss_kb
+ */
+
+#include "myalloc.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+struct result {
+    double seconds;
+    double ops_per_sec;
+    long peak_rss_kb;
+};
+
+static void *(*alloc)(size_t);
+static void (*release)(void *);
+
+static void* glibc_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+static void* myalloc_malloc(size_t size)
+{
+    return my_malloc(size, NO_FILL);
+}
+
+/* runs body(0), ..., body(threads - 1) in parallel */
+template <typename Body>
+static void parallel(int threads, Body body)
+{
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; i++)
+    {
+        pool.emplace_back(body, i);
+    }
+    for (auto &t : pool)
+    {
+        t.join();
+    }
+}
+
+#define LARSON_SLOTS 1000
+#define LARSON_MIN 16
+#define LARSON_MAX 512
+#define LARSON_EPOCHS 10
+#define LARSON_STEPS 20000
+
+static long larson(int threads, long scale)
+{
+    std::vector<std::vector<void *>> slots(threads, std::vector<void *>(LARSON_SLOTS));
+    unsigned seed = 1;
+    for (auto &thread_slots : slots)
+    {
+        for (void *&slot : thread_slots)
+        {
+            slot = alloc(LARSON_MIN + rand_r(&seed) % (LARSON_MAX - LARSON_MIN));
+        }
+    }
+
+    long steps = LARSON_STEPS * scale;
+    for (int epoch = 0; epoch < LARSON_EPOCHS; epoch++)
+    {
+        /* the blocks of every thread are inherited from another thread */
+        parallel(threads, [&](int id) {
+            std::vector<void *> &own = slots[(id + epoch) % threads];
+            unsigned seed = epoch * threads + id + 1;
+            for (long i = 0; i < steps; i++)
+            {
+                int slot = rand_r(&seed) % LARSON_SLOTS;
+                release(own[slot]);
+                own[slot] = alloc(LARSON_MIN + rand_r(&seed) % (LARSON_MAX - LARSON_MIN));
+            }
+        });
+    }
+
+    for (auto &thread_slots : slots)
+    {
+        for (void *slot : thread_slots)
+        {
+            release(slot);
+        }
+    }
+    return 2L * LARSON_EPOCHS * steps * threads;
+}
+
+#define THREADTEST_OBJECTS 100000
+#define THREADTEST_ITERATIONS 50
+#define THREADTEST_SIZE 64
+
+static long threadtest(int threads, long scale)
+{
+    long objects = THREADTEST_OBJECTS / threads;
+    long iterations = THREADTEST_ITERATIONS * scale;
+    parallel(threads, [&](int) {
+        std::vector<void *> blocks(objects);
+        for (long i = 0; i < iterations; i++)
+        {
+            for (long j = 0; j < objects; j++)
+            {
+                blocks[j] = alloc(THREADTEST_SIZE);
+                *(volatile char *) blocks[j] = 1;
+            }
+            for (long j = 0; j < objects; j++)
+            {
+                release(blocks[j]);
+            }
+        }
+    });
+    return 2 * objects * iterations * threads;
+}
+
+#define CACHE_SIZE 8
+#define CACHE_ITERATIONS 20000
+#define CACHE_REPETITIONS 200
+
+/* allocates, writes and frees small blocks */
+static void cache_worker(long iterations)
+{
+    for (long i = 0; i < iterations; i++)
+    {
+        volatile char *block = (volatile char *) alloc(CACHE_SIZE);
+        for (int r = 0; r < CACHE_REPETITIONS; r++)
+        {
+            for (int j = 0; j < CACHE_SIZE; j++)
+            {
+                block[j]++;
+            }
+        }
+        release((void *) block);
+    }
+}
+
+static long cache_scratch(int threads, long scale)
+{
+    /* small blocks of the main thread, probably on the same cache lines */
+    std::vector<void *> initial(threads);
+    for (void *&block : initial)
+    {
+        block = alloc(CACHE_SIZE);
+    }
+    long iterations = CACHE_ITERATIONS * scale;
+    parallel(threads, [&](int id) {
+        release(initial[id]);
+        cache_worker(iterations);
+    });
+    return (2 * iterations + 1) * threads;
+}
+
+static long cache_thrash(int threads, long scale)
+{
+    long iterations = CACHE_ITERATIONS * scale;
+    parallel(threads, [&](int) {
+        cache_worker(iterations);
+    });
+    return 2 * iterations * threads;
+}
+
+#define XMALLOC_BLOCKS 200000
+#define XMALLOC_QUEUE 1024
+#define XMALLOC_MIN 16
+#define XMALLOC_MAX 256
+
+/* single producer, single consumer ring of blocks */
+struct xmalloc_queue {
+    std::atomic<long> head{0};
+    std::atomic<long> tail{0};
+    void *blocks[XMALLOC_QUEUE];
+};
+
+static long xmalloc(int threads, long scale)
+{
+    int pairs = threads > 1 ? threads / 2 : 1;
+    long blocks = XMALLOC_BLOCKS * scale;
+    std::vector<xmalloc_queue> queues(pairs);
+    parallel(2 * pairs, [&](int id) {
+        xmalloc_queue &queue = queues[id / 2];
+        if (id % 2 == 0)
+        {
+            unsigned seed = id + 1;
+            for (long i = 0; i < blocks; i++)
+            {
+                void *block = alloc(XMALLOC_MIN + rand_r(&seed) % (XMALLOC_MAX - XMALLOC_MIN));
+                *(char *) block = 1;
+                long tail = queue.tail.load(std::memory_order_relaxed);
+                while (tail - queue.head.load(std::memory_order_acquire) == XMALLOC_QUEUE)
+                {
+                    sched_yield();
+                }
+                queue.blocks[tail % XMALLOC_QUEUE] = block;
+                queue.tail.store(tail + 1, std::memory_order_release);
+            }
+        } else {
+            for (long i = 0; i < blocks; i++)
+            {
+                long head = queue.head.load(std::memory_order_relaxed);
+                while (queue.tail.load(std::memory_order_acquire) == head)
+                {
+                    sched_yield();
+                }
+                release(queue.blocks[head % XMALLOC_QUEUE]);
+                queue.head.store(head + 1, std::memory_order_release);
+            }
+        }
+    });
+    return 2 * blocks * pairs;
+}
+
+#define MSTRESS_SLOTS 500
+#define MSTRESS_SHARED 1024
+#define MSTRESS_STEPS 200000
+
+static long mstress(int threads, long scale)
+{
+    std::vector<std::atomic<void *>> shared(MSTRESS_SHARED);
+    for (auto &slot : shared)
+    {
+        slot.store(nullptr);
+    }
+    std::atomic<long> operations{0};
+    long steps = MSTRESS_STEPS * scale;
+    parallel(threads, [&](int id) {
+        void *slots[MSTRESS_SLOTS] = {0};
+        unsigned seed = id + 1;
+        long ops = 0;
+        for (long i = 0; i < steps; i++)
+        {
+            int r = rand_r(&seed);
+            void *&slot = slots[r % MSTRESS_SLOTS];
+            if (slot != nullptr && r % 8 == 0)
+            {
+                /* passes the block to the thread which takes the shared slot */
+                slot = shared[rand_r(&seed) % MSTRESS_SHARED].exchange(slot);
+                continue;
+            }
+            release(slot);
+            /* mostly small sizes, some of them up to 32 KiB */
+            size_t size = (size_t) 8 << (r % 16 == 1 ? 12 : (r / 16) % 6);
+            slot = alloc(size + rand_r(&seed) % size);
+            *(char *) slot = 1;
+            ops += 2;
+        }
+        for (void *slot : slots)
+        {
+            release(slot);
+        }
+        operations += ops;
+    });
+    for (auto &slot : shared)
+    {
+        release(slot.load());
+    }
+    return operations;
+}
+
+struct benchmark {
+    const char *name;
+    long (*run)(int threads, long scale);
+};
+
+static const struct benchmark benchmarks[] = {
+    {"larson", &larson},
+    {"threadtest", &threadtest},
+    {"cache-scratch", &cache_scratch},
+    {"cache-thrash", &cache_thrash},
+    {"xmalloc", &xmalloc},
+    {"mstress", &mstress},
+};
+
+/* runs one configuration */
+static struct result run(const struct benchmark *bench, const char *allocator,
+                         int arenas, int threads, long scale)
+{
+    alloc = &myalloc_malloc;
+    release = &my_free;
+    if (strcmp(allocator, "glibc") == 0)
+    {
+        alloc = &glibc_malloc;
+        release = &free;
+    } else {
+        set_algorithm(allocator);
+        set_arenas(arenas);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    long operations = bench->run(threads, scale);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return {elapsed.count(), operations / elapsed.count(), usage.ru_maxrss};
+}
+
+/* runs one configuration in a child process */
+static int run_isolated(const struct benchmark *bench, const char *allocator,
+                        int arenas, int threads, long scale, struct result *result)
+{
+    int fds[2];
+    if (pipe(fds) == -1)
+    {
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        struct result r = run(bench, allocator, arenas, threads, scale);
+        if (write(fds[1], &r, sizeof(r)) != sizeof(r))
+            _exit(1);
+        _exit(0);
+    }
+
+    int status = 0;
+    close(fds[1]);
+    if (pid == -1 || read(fds[0], result, sizeof(*result)) != sizeof(*result))
+    {
+        status = -1;
+    }
+    close(fds[0]);
+    if (pid != -1)
+    {
+        waitpid(pid, NULL, 0);
+    }
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *const allocators[] = {"firstfit", "buddy", "glibc"};
+
+    const char *only_benchmark = NULL, *only_allocator = NULL;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN), arenas = 1;
+    long scale = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:a:t:A:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b': only_benchmark = optarg; break;
+        case 'a': only_allocator = optarg; break;
+        case 't': threads = atoi(optarg); break;
+        case 'A': arenas = atoi(optarg); break;
+        case 's': scale = atol(optarg); break;
+        default: threads = 0;
+        }
+    }
+    if (threads < 1 || scale < 1 || optind != argc)
+    {
+        fprintf(stderr, "usage: %s [-b benchmark] [-a firstfit|buddy|glibc] [-t threads] "
+                "[-A arenas] [-s scale]\n", argv[0]);
+        return 1;
+    }
+
+    printf("benchmark,allocator,arenas,threads,seconds,ops_per_sec,peak_rss_kb\n");
+    for (const struct benchmark &bench : benchmarks)
+    {
+        if (only_benchmark != NULL && strcmp(bench.name, only_benchmark) != 0)
+            continue;
+        for (const char *allocator : allocators)
+        {
+            if (only_allocator != NULL && strcmp(allocator, only_allocator) != 0)
+                continue;
+            struct result r;
+            if (run_isolated(&bench, allocator, arenas, threads, scale, &r) == -1)
+            {
+                fprintf(stderr, "%s,%s failed\n", bench.name, allocator);
+                continue;
+            }
+            printf("%s,%s,%d,%d,%.3f,%.0f,%ld\n", bench.name, allocator,
+                   strcmp(allocator, "glibc") == 0 ? 0 : arenas, threads,
+                   r.seconds, r.ops_per_sec, r.peak_rss_kb);
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * tracereplay.cpp
+ *
+ * Replays a trace recorded by set_trace (or MYALLOC_TRACE of the preload
+ * library) against the first fit policies, buddy and the C library, at
+ * full speed (the time deltas of the trace are ignored).
+ *
+ * The trace is read before the clock is started. Each allocator runs in its
+ * own process because the algorithm can only be set once, and so the peak
+ * RSS of one does not hide the next. The overhead is the growth of the RSS
+ * divided by the peak of the live requested bytes.
+ *
+ * usage: tracereplay [-a allocator] [-A arenas] trace
+ *
+ * The results are printed as CSV:
+ *      allocator,operations,seconds,ops_per_sec,peak_live_kb,peak_rss_kb,overhead
+ */
+
+#include "myalloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <vector>
+
+struct result {
+    double seconds;
+    long peak_live_kb;
+    long peak_rss_kb;
+    double overhead;
+};
+
+struct allocator {
+    void *(*malloc)(size_t size);
+    void *(*aligned_alloc)(size_t alignment, size_t size);
+    void *(*realloc)(void *ptr, size_t size);
+    void (*free)(void *ptr);
+};
+
+static void* glibc_aligned_alloc(size_t alignment, size_t size)
+{
+    void *ptr;
+    return posix_memalign(&ptr, alignment < sizeof(void *) ? sizeof(void *) : alignment,
+                          size) == 0 ? ptr : NULL;
+}
+
+static void* myalloc_malloc(size_t size)
+{
+    return my_malloc(size, NO_FILL);
+}
+
+static void* myalloc_aligned_alloc(size_t alignment, size_t size)
+{
+    return my_aligned_alloc(alignment, size, NO_FILL);
+}
+
+static void* myalloc_realloc(void *ptr, size_t size)
+{
+    return my_realloc(ptr, size, NO_FILL);
+}
+
+static const struct allocator glibc = {&malloc, &glibc_aligned_alloc, &realloc, &free};
+static const struct allocator myalloc = {&myalloc_malloc, &myalloc_aligned_alloc,
+                                         &myalloc_realloc, &my_free};
+
+/* reads the records of the trace, returns false if it is not a trace */
+static bool read_trace(const char *path, std::vector<trace_record> &records)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return false;
+    }
+    char magic[TRACE_MAGIC_SIZE];
+    bool valid = fread(magic, 1, TRACE_MAGIC_SIZE, file) == TRACE_MAGIC_SIZE
+        && memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) == 0;
+    trace_record record;
+    while (valid && fread(&record, sizeof(record), 1, file) == 1)
+    {
+        records.push_back(record);
+    }
+    fclose(file);
+    return valid;
+}
+
+/* replays the trace with one allocator */
+static struct result run(const char *name, int arenas, const std::vector<trace_record> &records)
+{
+    const struct allocator *a = &glibc;
+    if (strcmp(name, "glibc") != 0)
+    {
+        a = &myalloc;
+        set_algorithm(name);
+        set_arenas(arenas);
+    }
+
+    uint32_t max_id = 0;
+    for (const trace_record &record : records)
+    {
+        max_id = record.id > max_id ? record.id : max_id;
+    }
+    std::vector<char *> blocks(max_id + 1);
+    std::vector<size_t> sizes(max_id + 1);
+
+    struct result result = {};
+    long live = 0, peak_live = 0;
+    for (const trace_record &record : records)
+    {
+        size_t size = TRACE_OP(&record) == TRACE_FREE ? 0 : TRACE_REQUEST(&record);
+        live += (long) size - (long) sizes[record.id];
+        sizes[record.id] = size;
+        peak_live = live > peak_live ? live : peak_live;
+    }
+    result.peak_live_kb = peak_live / 1024;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long base_rss = usage.ru_maxrss;
+
+    auto start = std::chrono::steady_clock::now();
+    for (const trace_record &record : records)
+    {
+        char *&block = blocks[record.id];
+        size_t size = TRACE_REQUEST(&record);
+        switch (TRACE_OP(&record))
+        {
+        case TRACE_MALLOC:
+            block = (char *) (TRACE_ALIGN_SHIFT(&record) == 0 ? a->malloc(size)
+                : a->aligned_alloc((size_t) 1 << TRACE_ALIGN_SHIFT(&record), size));
+            if (block != NULL && size > 0)
+                block[0] = 1;
+            break;
+        case TRACE_REALLOC:
+            block = (char *) a->realloc(block, size);
+            if (block != NULL && size > 0)
+                block[size - 1] = 1;
+            break;
+        case TRACE_FREE:
+            a->free(block);
+            block = NULL;
+            break;
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    result.seconds = elapsed.count();
+
+    getrusage(RUSAGE_SELF, &usage);
+    result.peak_rss_kb = usage.ru_maxrss;
+    result.overhead = result.peak_live_kb > 0
+        ? (double) (usage.ru_maxrss - base_rss) / result.peak_live_kb : 0;
+    return result;
+}
+
+/* replays the trace in a child process */
+static int run_isolated(const char *name, int arenas, const std::vector<trace_record> &records,
+                        struct result *result)
+{
+    int fds[2];
+    if (pipe(fds) == -1)
+    {
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        struct result r = run(name, arenas, records);
+        if (write(fds[1], &r, sizeof(r)) != sizeof(r))
+            _exit(1);
+        _exit(0);
+    }
+
+    int status = 0;
+    close(fds[1]);
+    if (pid == -1 || read(fds[0], result, sizeof(*result)) != sizeof(*result))
+    {
+        status = -1;
+    }
+    close(fds[0]);
+    if (pid != -1)
+    {
+        waitpid(pid, NULL, 0);
+    }
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *const allocators[] = {"firstfit", "bestfit", "nextfit", "addressfit",
+                                             "buddy", "glibc"};
+
+    const char *only_allocator = NULL;
+    int arenas = 1;
+    bool usage = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:A:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a': only_allocator = optarg; break;
+        case 'A': arenas = atoi(optarg); break;
+        default: usage = true;
+        }
+    }
+    std::vector<trace_record> records;
+    if (usage || optind != argc - 1)
+    {
+        fprintf(stderr, "usage: %s [-a firstfit|bestfit|nextfit|addressfit|buddy|glibc] "
+                "[-A arenas] trace\n", argv[0]);
+        return 1;
+    }
+    if (!read_trace(argv[optind], records))
+    {
+        fprintf(stderr, "%s: cannot read the trace %s\n", argv[0], argv[optind]);
+        return 1;
+    }
+
+    printf("allocator,operations,seconds,ops_per_sec,peak_live_kb,peak_rss_kb,overhead\n");
+    for (const char *allocator : allocators)
+    {
+        if (only_allocator != NULL && strcmp(allocator, only_allocator) != 0)
+            continue;
+        struct result r;
+        if (run_isolated(allocator, arenas, records, &r) == -1)
+        {
+            fprintf(stderr, "%s failed\n", allocator);
+            continue;
+        }
+        printf("%s,%zu,%.3f,%.0f,%ld,%ld,%.2f\n", allocator, records.size(), r.seconds,
+               r.seconds > 0 ? records.size() / r.seconds : 0, r.peak_live_kb,
+               r.peak_rss_kb, r.overhead);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * arena.h
+ *
+ * The heap of each allocation algorithm is split into independent arenas,
+ * each with its own blocks, region (see region.h) and lock. Every arena uses
+ * an mmap region by default. The main arena (arena 0) can use the program
+ * break instead (see arena_set_brk).
+ *
+ * If there is an arena for every CPU, a thread allocates from the arena of
+ * the CPU it is running on (sched_getcpu). Otherwise each thread is bound to
+ * one arena in round-robin order the first time it allocates. Blocks are
+ * always freed to the arena which owns them.
+ */
+
+#pragma once
+
+#ifndef _arena_H_
+#define _arena_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* maximum number of arenas */
+#define MAX_ARENAS 64
+
+/**
+ * @brief sets the number of arenas
+ * 
+ * It should be used before the first allocation. By default there is only
+ * one arena.
+ * 
+ * ERRORS: errno will be
+ *  31: if an arena was used before
+ * 
+ * @param count number of arenas, if it is not positive the number of configured
+ *              CPUs is used. It is limited to MAX_ARENAS.
+ * @return int number of arenas or -1 on error
+ */
+int arena_set_count(int count);
+
+/**
+ * @brief sets whether the main arena grows with the program break
+ * 
+ * The heap of an arena is contiguous, so a REGION_BRK heap cannot grow any
+ * more once somebody else (e.g. the malloc of the C library, which is used
+ * by stdio and the C++ runtime) moves the break. Therefore it is only used
+ * when the library is the only allocator of the process (the LD_PRELOAD
+ * library, see preload.c). Like the number of arenas, it should be set
+ * before the first allocation.
+ * 
+ * ERRORS: errno will be
+ *  31: if an arena was used before
+ * 
+ * @param enabled non zero to use the program break for arena 0
+ * @return int 1 if the break is used, 0 if not or -1 on error
+ */
+int arena_set_brk(int enabled);
+
+/**
+ * @brief returns the kind of the region of arena `index` (see region.h)
+ */
+int arena_region_kind(int index);
+
+/**
+ * @brief returns the number of arenas
+ */
+int arena_get_count();
+
+/**
+ * @brief returns the index of the arena the calling thread should use
+ * 
+ * The first call of each thread binds it to an arena.
+ */
+int arena_index();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -10,36 +10,71 @@
 extern "C" {
 #endif
 
+/* All of the functions are thread-safe. Each arena (see arena.h) has its own
+   lock and a block freed by a thread of another arena is queued without it. */
 
-#define BUD_BLOCK_SIZE 48
+#define BUD_BLOCK_SIZE 16
+
+/* Largest request, the request of a block is kept in 48 bits of its info */
+#define BUD_MAX_REQUEST ((1UL << 48) - 1)
+
+/* Number of block orders (order i holds blocks of 2^i bytes) */
+#define BUD_ORDERS 64
+
+/* Default size of free blocks whose pages are given back to the system */
+#define BUD_RELEASE_THRESHOLD (1024 * 1024L)
+
+/* Default order of the chunks the heap grows by (4 MiB) and its bounds */
+#define BUD_MAX_ORDER 22
+#define BUD_MIN_MAX_ORDER 12
+#define BUD_MAX_MAX_ORDER 40
 
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
+#include "fill.h"
+#include "stats.h"
 
 /**
  * @brief allocates size bytes in the memory
  * 
  * Allocation Process:
- *  - find the best fit (equal or smallest possible) in the free allocated list
+ *  - find the best fit (equal or smallest possible) in the per-order free
+ *    lists
  *  - if found an equal allocate it
  *  - if found a bigger free block split it until fit.
- *  - if 404 not found, then allocate twice as allocated size now and do the
+ *  - if 404 not found, then grow the heap (see bud_set_max_order) and do the
  *    splitting.
  *  - if can't allocate new storage, return NULL.
  * 
  * After allocation it will set all bytes to `fill` value. Note that fill is
- * passed as integer but it will use unsigned char conversion of it.
+ * passed as integer but it will use unsigned char conversion of it. Blocks
+ * that are known to be zero are not filled with zero again.
  * 
  *  NOTE: it will return NULL on impossible requests (irrational or not enough
  *        storage or not in bound)
  * 
  * @param size size to be allocated
- * @param fill fills allocated size with fill value
+ * @param fill fills allocated size with fill value (or NO_FILL, see fill.h)
  * @return void* 
  */
 void* bud_malloc(size_t size, int fill);
 
+/**
+ * @brief allocates size bytes at a multiple of alignment
+ * 
+ * Blocks are naturally aligned to their size, so the data is placed
+ * `alignment` bytes after the start of the block (instead of right after its
+ * header) and a tag before the data points back to the header. Alignments
+ * up to 16 are served by bud_malloc.
+ * 
+ * @param alignment a power of two
+ * @param size size to be allocated
+ * @param fill fills allocated size with fill value (or NO_FILL, see fill.h)
+ * @return void* NULL on failure or if alignment is not a power of two
+ */
+void* bud_aligned_alloc(size_t alignment, size_t size, int fill);
+
 /**
  * @brief reallocate the pointer with new memory size
  * 
@@ -53,11 +88,14 @@ void* bud_malloc(size_t size, int fill);
  *  - if ptr is NULL, then it is equivalent of malloc
  *  - if ptr was not allocated before it will return NULL
  *  - if request size (next_pow2) is same as previous one, it will return ptr
+ *  - if the block is the left half of its parent and the right halves are
+ *    free up to the new request size (or the block is at the top of the heap,
+ *    which is extended), they are merged and ptr is returned without copying
  *  - if allocation of size failed, NULL is returned
  * 
  * @param ptr previously allocated memory pointer
  * @param size new size that is needed
- * @param fill fills allocated size with fill value
+ * @param fill fills allocated size with fill value (or NO_FILL, see fill.h)
  * @return address of the new memory. NULL in case of failure
  */
 void* bud_realloc(void* ptr, size_t size, int fill);
@@ -66,16 +104,68 @@ void* bud_realloc(void* ptr, size_t size, int fill);
  * @brief frees pre-allocated memory
  * 
  * This functions marks the pointer free and tries to coalesce as much as
- * possible with childs in the same depth, same parent and rightness of the
- * next block be 1 and current zero (In other words we test the block to
- * be the left child and coalesce it with the right child it both are free).
- * If the coalesce process was successful, then it will try for another time
- * until it cannot anymore.
+ * possible with its buddy. The buddy of a block is found by XOR-ing the
+ * offset of the block (from the start of the heap) with its size. If the
+ * buddy is a whole free block of the same size, the two are merged and the
+ * process repeats for the merged block until it cannot anymore.
  * 
  * @param ptr pointer to a pre-allocated memory
  */
 void bud_free(void* ptr);
 
+/**
+ * @brief frees a block whose size is known
+ * 
+ * The order of the block follows from the size, so the header right before
+ * ptr is trusted if it has that order (and its checksum) and the validation
+ * of bud_free is skipped. Aligned blocks are looked up like bud_free.
+ * 
+ * @param ptr pointer to a pre-allocated memory
+ * @param size the size requested for the block
+ * @return int 0 if ptr is not in the heap of any arena (nothing is done)
+ */
+int bud_free_sized(void* ptr, size_t size);
+
+/**
+ * @brief allocates `count` blocks of size bytes at once
+ * 
+ * The blocks are taken from the free lists (splitting the bigger blocks and
+ * growing the heap like bud_malloc) with a single acquisition of the lock
+ * for every 64 blocks, instead of one for each block.
+ * 
+ * @param size the size of each block
+ * @param count number of blocks
+ * @param out the blocks are stored in out[0], out[1], ...
+ * @param fill fills allocated size with fill value (or NO_FILL, see fill.h)
+ * @return size_t number of allocated blocks (at the start of out), it is
+ *         less than count on failure
+ */
+size_t bud_malloc_batch(size_t size, size_t count, void** out, int fill);
+
+/**
+ * @brief frees `count` blocks at once
+ * 
+ * The blocks of the arena of the calling thread are freed and coalesced
+ * under a single acquisition of its lock, the others are queued to their
+ * arenas like bud_free. Invalid pointers are ignored.
+ * 
+ * @param ptrs pointers to pre-allocated memory
+ * @param count number of pointers
+ */
+void bud_free_batch(void** ptrs, size_t count);
+
+
+/**
+ * @brief returns the number of bytes that can be used in an allocated block
+ * 
+ * It is the size of the block minus its header, so it is at least the size
+ * requested for the block. It does not take the allocator lock.
+ * 
+ * @param ptr pointer to a pre-allocated memory
+ * @return size_t 0 if ptr is not an allocated block
+ */
+size_t bud_usable_size(void* ptr);
+
 
 /**
  * @brief Shows the status of the allocated memory
@@ -86,6 +176,30 @@ void bud_free(void* ptr);
  */
 void bud_show_stats();
 
+/**
+ * @brief adds the statistics of the arenas to stats
+ * 
+ * It only reads the counters of the arenas (see stats.h).
+ * 
+ * @param stats statistics to be added to
+ */
+void bud_get_stats(struct my_heap_stats *stats);
+
+/**
+ * @brief takes every lock of the arenas of buddy (before fork)
+ *
+ * The locks are taken in a fixed order, see my_fork_prepare.
+ */
+void bud_fork_lock();
+
+/**
+ * @brief releases the locks taken by bud_fork_lock (after fork)
+ *
+ * @param child non zero in the child, the locks are initialized again there
+ *              as the threads which may wait for them do not exist
+ */
+void bud_fork_unlock(int child);
+
 /**
  * @brief sets minimum size that can be allocated
  * 
@@ -94,9 +208,9 @@ void bud_show_stats();
  *      - if min provided in less than 0, 0 will be the min.
  * 
  * @param min min value
- * @return int setted min value
+ * @return long setted min value
  */
-int bud_set_minimum(int min);
+long bud_set_minimum(long min);
 
 /**
  * @brief sets maximum size that can be allocated
@@ -107,45 +221,72 @@ int bud_set_minimum(int min);
  *      - max should be at least 1 or -1 for no limit
  * 
  * @param max max value
- * @return int setted max value
+ * @return long setted max value
  */
-int bud_set_maximum(int max);
-
-typedef struct bud_block *bud_meta;
+long bud_set_maximum(long max);
 
 /**
- * @brief this struct will be used as metadata header
+ * @brief sets the size of free blocks whose pages are given back
  * 
- * size is the order of the block allocated (i.e. 64, 128, ...) and not
- * the size user requested.
+ * When a free block of at least `threshold` bytes is made by bud_free, the
+ * whole pages inside it (after its header) are released with madvise, and
+ * the free blocks at the top of the heap are given back. Default is
+ * BUD_RELEASE_THRESHOLD.
+ * 
+ * @param threshold size in bytes, -1 keeps every page
+ * @return long the threshold
+ */
+long bud_set_release_threshold(long threshold);
+
+/**
+ * @brief sets the order of the chunks the heaps grow by
  * 
- * next and prev are used for linked list structure of the memory.
+ * A heap doubles until it is 2^order bytes and then grows by a chunk of that
+ * size at a time, so growing a big heap costs no more than a chunk. Every
+ * chunk is a separate buddy tree: blocks are not merged above the chunk
+ * size and a request which does not fit in a chunk gets a block of its own
+ * order at the top of the heap. It can be changed at any time, it applies to
+ * the next growths and merges. Default is BUD_MAX_ORDER.
  * 
- * is_free is freeness of the block which will be used as a marker so we can 
- * coalesce free memories if possible.
+ * @param order log2 of the chunk size, limited to
+ *              [BUD_MIN_MAX_ORDER, BUD_MAX_MAX_ORDER]
+ * @return int the order
+ */
+int bud_set_max_order(int order);
+
+typedef struct bud_block *bud_meta;
+
+/**
+ * @brief this struct will be used as metadata header
  * 
- * depth is how many times split was done on the memory.
+ * info packs everything about the block (see buddy.c): the FREE flag, a flag
+ * which is set for FREE blocks whose data is known to be zero (see fill.h,
+ * except the links), the order of the block (log2 of its size, i.e. 64, 128,
+ * ... and not the size user requested), the alignment of the data of blocks
+ * from bud_aligned_alloc and the size requested by the user for an allocated
+ * block.
  * 
- * rightness is a number which ith bit of it will show weather the parent was
- * right node or left node of the tree. It will be used to compare left and
- * right nodes to coalesce two blocks with same parent.
+ * magic is a checksum of the address and info of an allocated block. It is
+ * checked before the header of a pointer given by the user is trusted.
  * 
- * ptr is the pointer returned to the user and is kept for simplicity of search
- * process.
+ * next and prev link the FREE blocks of the same order (free lists). They are
+ * in the first bytes of the data, so an allocated block only has the header
+ * of BUD_BLOCK_SIZE bytes.
  * 
  * data is dummy pointer (no bytes is occupied to the first data block of the
  * memory).
  */
 struct bud_block {
-    size_t size;
-    struct bud_block *next;
-    struct bud_block *prev;
-    int is_free;
-    int depth;
-    int rightness;
-    void *ptr;
-    /* A pointer to the allocated block */
-    char data [0];
+    size_t info;
+    uintptr_t magic;
+    union {
+        struct {
+            struct bud_block *next;
+            struct bud_block *prev;
+        };
+        /* A pointer to the allocated block */
+        char data [0];
+    };
  };
 
 #ifdef __cplusplus
@@ -0,0 +1,48 @@
+/*
+ * fill.h
+ *
+ * Every allocation function takes a `fill` byte which is written to the
+ * whole allocated space. Two cases do not need the memset:
+ *
+ *      - NO_FILL is passed as `fill`, because the caller overwrites the
+ *        space right away.
+ *      - `fill` is zero and the memory is known to be zero already (memory
+ *        which is fresh from the system or was given back to it). The
+ *        algorithms track this for their free blocks.
+ */
+
+#pragma once
+
+#ifndef _fill_H_
+#define _fill_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <limits.h>
+#include <string.h>
+
+/* `fill` value which leaves the allocated space as it is */
+#define NO_FILL INT_MIN
+
+/**
+ * @brief fills size bytes at ptr with fill unless it is not needed
+ * 
+ * @param ptr start of the space
+ * @param fill fill value (or NO_FILL)
+ * @param size number of bytes
+ * @param zero whether the space is known to be zero
+ */
+static inline void fill_memory(void *ptr, int fill, size_t size, int zero)
+{
+    if (fill == NO_FILL || (fill == 0 && zero))
+        return;
+    memset(ptr, fill, size);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,6 +4,9 @@
  * firstfit.h
  *
  * Exports a clone of the interface documented in "man 3 fuckmalloc".
+ *
+ * All of the functions are thread-safe. Each arena (see arena.h) has its own
+ * lock and a block freed by a thread of another arena is queued without it.
  */
 
 #pragma once
@@ -11,14 +14,33 @@
 #ifndef _firstfit_H_
 #define _firstfit_H_
 
- /* Define the block size since the sizeof will be wrong */
-#define BLOCK_SIZE 40
+ /* Define the block size since the sizeof will be wrong (it is the header of
+  * an allocated block, the free list links are in the data) */
+#define BLOCK_SIZE 16
+
+/* sizes of the blocks are multiples of FF_ALIGN, so are their data */
+#define FF_ALIGN 16
+
+/* smallest data of a block, a FREE block keeps its links and footer there */
+#define FF_MIN_SIZE 32
+
+/* Number of size classes of the free lists (class i holds [2^i, 2^(i+1))) */
+#define FF_CLASSES 64
+
+/* search policies of the free lists (see ff_set_policy) */
+#define FF_FIRST_FIT 0
+#define FF_BEST_FIT 1
+#define FF_NEXT_FIT 2
+#define FF_ADDRESS_FIT 3
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #include <stdlib.h>
+#include <stdint.h>
+#include "fill.h"
+#include "stats.h"
 
 /**
  * @brief Allocates size bytes in the heap and returns the address
@@ -28,25 +50,41 @@ extern "C" {
  * failure it is!
  * 
  * @param size the size of allocation
- * @param fill fills allocated size with fill value
+ * @param fill fills allocated size with fill value (or NO_FILL, see fill.h)
  * @return address of the begining of the allocated memory. it will
  *         return NULL if the size is 0 or on error.
  */
 void* ff_malloc(size_t size, int fill);
 
+/**
+ * @brief Allocates size bytes at a multiple of alignment
+ * 
+ * A block with room for the data and the padding in front of it is found
+ * like ff_malloc. The padding becomes a FREE block and the rest of the block
+ * after the data is split as usual, so nothing is wasted.
+ * 
+ * @param alignment a power of two
+ * @param size the size of allocation
+ * @param fill fills allocated size with fill value (or NO_FILL, see fill.h)
+ * @return void* NULL on failure or if alignment is not a power of two
+ */
+void* ff_aligned_alloc(size_t alignment, size_t size, int fill);
+
 /**
  * @brief reallocate the pointer with new memory size
  * 
  * If the size is smaller than the current size split will be done on the
  * block, but, if the size is bigger than the current size first it will check
- * if there is enough FREE space after this block. If it was available the
- * block would be expanded. If there wasn't enough space after program searches
+ * if there is enough FREE space after this block (or if the block, or the FREE
+ * block after it, is the last one, so the heap can be extended). If it was
+ * available the block would be expanded in place, without copying the data.
+ * If there wasn't enough space after program searches
  * for a FREE space generally and if any wasn't found heap will be expanded and
  * if that failed too nothing would change and NULL will be returned.
  * 
  * @param ptr previously allocated memory pointer
  * @param size new size that is needed
- * @param fill fills allocated size with fill value
+ * @param fill fills allocated size with fill value (or NO_FILL, see fill.h)
  * @return address of the new memory. NULL in case of failure
  */
 void* ff_realloc(void* ptr, size_t size, int fill);
@@ -61,6 +99,84 @@ void* ff_realloc(void* ptr, size_t size, int fill);
  */
 void ff_free(void* ptr);
 
+/**
+ * @brief frees a block whose size is known
+ * 
+ * The caller vouches for ptr, so the checks of ff_get_block (bounds, FREE
+ * state) are skipped and only the checksum of the header is checked when it
+ * is claimed. The freed block is put into the class of its own size, so the
+ * size is not needed otherwise.
+ * 
+ * @param ptr pointer to a pre-allocated memory
+ * @param size the size requested for the block
+ * @return int 0 if ptr is not in the heap of any arena (nothing is done)
+ */
+int ff_free_sized(void* ptr, size_t size);
+
+/**
+ * @brief allocates `count` blocks of size bytes at once
+ * 
+ * One free block (or one extension of the heap) big enough for all of them
+ * is found like ff_malloc and carved into the blocks, so the free lists are
+ * searched once under a single acquisition of the lock. If there is no such
+ * block they are allocated one by one.
+ * 
+ * @param size the size of each block
+ * @param count number of blocks
+ * @param out the blocks are stored in out[0], out[1], ...
+ * @param fill fills allocated size with fill value (or NO_FILL, see fill.h)
+ * @return size_t number of allocated blocks (at the start of out), it is
+ *         less than count on failure
+ */
+size_t ff_malloc_batch(size_t size, size_t count, void** out, int fill);
+
+/**
+ * @brief frees `count` blocks at once
+ * 
+ * The blocks of the arena of the calling thread are freed and fused (in
+ * constant time each) under a single acquisition of its lock, the others
+ * are queued to their arenas like ff_free. Invalid pointers are ignored.
+ * 
+ * @param ptrs pointers to pre-allocated memory
+ * @param count number of pointers
+ */
+void ff_free_batch(void** ptrs, size_t count);
+
+/**
+ * @brief returns the number of bytes that can be used in an allocated block
+ * 
+ * It is at least the size requested for the block. It does not take the
+ * allocator lock.
+ * 
+ * @param ptr pointer to a pre-allocated memory
+ * @return size_t 0 if ptr is not an allocated block
+ */
+size_t ff_usable_size(void* ptr);
+
+/**
+ * @brief sets the policy which chooses between the fitting free blocks
+ * 
+ * Each policy keeps the free list of every size class in its own order:
+ * 
+ *      FF_FIRST_FIT    the last freed block first, the first fitting one
+ *                      is taken (default)
+ *      FF_BEST_FIT     sorted by size, so the first fitting block of a
+ *                      class is the smallest one
+ *      FF_NEXT_FIT     like first fit, but every class has a roving pointer
+ *                      and the search starts after the last taken block
+ *      FF_ADDRESS_FIT  sorted by address, the fitting block with the lowest
+ *                      address is taken (the heads of the bigger classes
+ *                      are compared too)
+ * 
+ * The sorted lists make freeing O(length of the list of the class).
+ * 
+ * NOTE: it should be set before the first allocation.
+ * 
+ * @param policy one of the FF_*_FIT values
+ * @return int the policy or -1 if it is not valid
+ */
+int ff_set_policy(int policy);
+
 /**
  * @brief sets minimum size that can be allocated
  * 
@@ -69,9 +185,9 @@ void ff_free(void* ptr);
  *      - if min provided in less than 0, 0 will be the min.
  * 
  * @param min min value
- * @return int setted min value
+ * @return long setted min value
  */
-int ff_set_minimum(int min);
+long ff_set_minimum(long min);
 
 /**
  * @brief sets maximum size that can be allocated
@@ -82,26 +198,75 @@ int ff_set_minimum(int min);
  *      - max should be at least 1 or -1 for no limit
  * 
  * @param max max value
- * @return int setted max value
+ * @return long setted max value
  */
-int ff_set_maximum(int max);
+long ff_set_maximum(long max);
 
 
 typedef struct s_block *s_block_ptr;
 
-/* block struct */
+/* block struct
+ *
+ * The blocks cover the heap of an arena without gaps, so the next block is
+ * found by adding the size to the data and the blocks are not linked in
+ * address order. The low bits of size hold the flags of the block (see
+ * firstfit.c): whether it is FREE, whether its data is known to be zero
+ * (except the links and the footer, see fill.h) and whether the block before
+ * is FREE. In the last case the size of the block before is also written in
+ * a footer at the end of its data, so its header can be found from this one
+ * (boundary tags).
+ *
+ * magic is a checksum of the address and size of an allocated block. It is
+ * checked before the header of a pointer given by the user is trusted. Its
+ * low bits hold the difference of the size and the size requested by the
+ * user, which is never large as the rest of a block is split when it can
+ * hold another one.
+ *
+ * next_free and prev_free link a FREE block into the free list of its size
+ * class. They are in the first bytes of the data, so an allocated block only
+ * has the header of BLOCK_SIZE bytes.
+ */
 struct s_block {
     size_t size;
-    struct s_block *next;
-    struct s_block *prev;
-    int is_free;
-    void *ptr;
-    /* A pointer to the allocated block */
-    char data [0];
+    uintptr_t magic;
+    union {
+        struct {
+            struct s_block *next_free;
+            struct s_block *prev_free;
+        };
+        /* A pointer to the allocated block */
+        char data [0];
+    };
  };
 
  void ff_show_stats();
 
+/**
+ * @brief adds the statistics of the arenas to stats
+ * 
+ * It only reads the counters of the arenas (see stats.h). The size of the
+ * largest block of each free list is kept too, the highest list is walked
+ * only when its largest block was taken since the last call.
+ * 
+ * @param stats statistics to be added to
+ */
+void ff_get_stats(struct my_heap_stats *stats);
+
+/**
+ * @brief takes every lock of the arenas of first fit (before fork)
+ *
+ * The locks are taken in a fixed order, see my_fork_prepare.
+ */
+void ff_fork_lock();
+
+/**
+ * @brief releases the locks taken by ff_fork_lock (after fork)
+ *
+ * @param child non zero in the child, the locks are initialized again there
+ *              as the threads which may wait for them do not exist
+ */
+void ff_fork_unlock(int child);
+
 #ifdef __cplusplus
 }
 #endif
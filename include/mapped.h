@@ -0,0 +1,134 @@
+/*
+ * mapped.h
+ *
+ * Large requests are served directly by mmap instead of the heaps of the
+ * allocation algorithms (see myalloc.h), so a big transient buffer does not
+ * inflate the heap for good (or, in buddy mode, round the heap up to the
+ * next power of two). Freeing such a block gives it back with munmap and
+ * resizing it remaps its pages instead of copying them.
+ *
+ * Every mapped block has a small header right before the user data. The
+ * live blocks are also kept in a hash set, so pointers are checked without
+ * reading memory that may have been unmapped (double free).
+ */
+
+#pragma once
+
+#ifndef _mapped_H_
+#define _mapped_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include "stats.h"
+
+/* bytes in front of the user data of a mapped block (also its alignment) */
+#define MAP_HEADER_SIZE 32
+
+/* default threshold (same as the default of glibc) */
+#define MAP_DEFAULT_THRESHOLD (128 * 1024L)
+
+/**
+ * @brief maps a new block of at least `size` bytes
+ *
+ * The pages of a fresh mapping are zero, so they are not filled when `fill`
+ * is zero (or NO_FILL).
+ *
+ * @param size size of the request
+ * @param fill fills allocated size with fill value (or NO_FILL, see fill.h)
+ * @return void* NULL on failure
+ */
+void* map_alloc(size_t size, int fill);
+
+/**
+ * @brief maps a new block of at least `size` bytes at a multiple of alignment
+ *
+ * @param alignment a power of two, at least MAP_HEADER_SIZE
+ * @param size size of the request
+ * @param fill fills allocated size with fill value (or NO_FILL, see fill.h)
+ * @return void* NULL on failure or invalid alignment
+ */
+void* map_alloc_aligned(size_t alignment, size_t size, int fill);
+
+/**
+ * @brief unmaps the block if ptr is a mapped block
+ *
+ * @param ptr any pointer
+ * @return int 1 if ptr was a mapped block (and is freed now), 0 otherwise
+ */
+int map_free(void* ptr);
+
+/**
+ * @brief resizes the mapped block to `size` bytes with mremap
+ *
+ * The mapping is extended or shrunk in place if possible, otherwise its pages
+ * are moved to a new address by the kernel, so the data is never copied. The
+ * bytes after the old request are filled with `fill` (the new pages are zero
+ * so they are not touched for a zero fill). The data keeps its offset in the
+ * mapping, but an alignment bigger than a page may be lost if it moves.
+ *
+ * @param ptr a mapped block
+ * @param size new size
+ * @param fill fills the new part with fill value
+ * @return void* NULL if ptr is not a mapped block or on failure (the block is
+ *         not changed then)
+ */
+void* map_realloc(void* ptr, size_t size, int fill);
+
+/**
+ * @brief returns the number of usable bytes of a mapped block
+ *
+ * @param ptr any pointer
+ * @return size_t 0 if ptr is not a mapped block
+ */
+size_t map_usable_size(void* ptr);
+
+/**
+ * @brief Set the threshold of mapped blocks
+ *
+ * Requests of at least `threshold` bytes are mapped (see map_should_map).
+ *
+ * @param threshold size in bytes, -1 disables mapping
+ * @return long the threshold
+ */
+long map_set_threshold(long threshold);
+
+/**
+ * @brief returns whether a request of `size` bytes should be mapped
+ */
+int map_should_map(size_t size);
+
+/**
+ * @brief prints the mapped blocks
+ *
+ * @return size_t total size of the mapped blocks (with their headers)
+ */
+size_t map_show_stats();
+
+/**
+ * @brief adds the number and the total size of the mapped blocks to stats
+ */
+void map_get_stats(struct my_heap_stats *stats);
+
+/**
+ * @brief takes every lock of the set of mapped blocks (before fork)
+ *
+ * The locks are taken in a fixed order, see my_fork_prepare.
+ */
+void map_fork_lock();
+
+/**
+ * @brief releases the locks taken by map_fork_lock (after fork)
+ *
+ * @param child non zero in the child, the locks are initialized again there
+ *              as the threads which may wait for them do not exist
+ */
+void map_fork_unlock(int child);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
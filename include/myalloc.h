@@ -9,11 +9,21 @@
  *      2. Buddy
  * 
  * + A minimum and maximum limit can be set for allocations
- * + First fit uses 40B and Buddy uses 48B of allocations as metadata.
+ * + Requests above a threshold are mapped directly with mmap (see mapped.h)
+ * + Aligned blocks can be allocated with my_aligned_alloc
+ * + NO_FILL skips the fill and zero fills are skipped for zero memory
+ * + Allocations can be recorded into a trace (see set_trace and trace.h)
+ * + Heap statistics are kept incrementally (see my_get_stats)
+ * + Small requests are packed into slabs without headers (see slab.h)
+ * + First fit and Buddy use 16B of allocations as metadata.
  * 
  * 
  * Time complexities:
- *      All Operations are O(N) in time complexity.
+ *      First fit allocation is linear only in the free blocks of the size
+ *      classes it scans (segregated free lists), and a freed block is
+ *      coalesced in O(1) with boundary tags. Buddy allocation and coalescing
+ *      are O(log N) with per-order free lists. Finding the block of a pointer
+ *      (free, realloc) is O(1).
  * 
  * Fragmentation:
  *      In worst case, both algorithms can waste ~50% of the memory with
@@ -24,6 +34,14 @@
  * First fit will be considered as your algorithm and cannot be changed further
  * in your code.
  * 
+ * Thread safety:
+ *      All of the functions are thread-safe, but the algorithm should be set
+ *      before other threads start to use the library. Small blocks freed by
+ *      my_free are kept in a per-thread cache (see tcache.h) and reused by
+ *      the next my_malloc of the same thread without taking any lock.
+ *      A block freed by a thread of another arena is pushed to a lock-free
+ *      queue of its arena, which is emptied by the next allocation there.
+ * 
  * @copyright Copyright (c) 2023
  * 
  */
@@ -38,35 +56,15 @@
 extern "C" {
 #endif
 
+#include "arena.h"
 #include "buddy.h"
+#include "fill.h"
 #include "firstfit.h"
-#include <string.h>
-#include <stdio.h>
-#include <errno.h>
-
-#define ALG_CHECK if (!alg.is_defined) \
-    { \
-        alg.is_defined = 1; \
-    }
-
-struct AlgorithmWrapper
-{
-    int is_defined;
-    void* (*my_malloc)(size_t, int);
-    void* (*my_realloc)(void*, size_t, int);
-    void  (*my_free)(void*);
-    void (*show_stats)();
-    int   (*set_maximum)(int);
-    int   (*set_minimum)(int);
-} alg = {0, 
-    &ff_malloc, 
-    &ff_realloc, 
-    &ff_free,
-    &ff_show_stats, 
-    &ff_set_maximum,
-    &ff_set_minimum
-};
-
+#include "mapped.h"
+#include "slab.h"
+#include "stats.h"
+#include "tcache.h"
+#include "trace.h"
 
 /**
  * @brief Set the algorithm
@@ -75,90 +73,239 @@ struct AlgorithmWrapper
  * used before any use of other function, otherwise, first fit will be
  * considered as the allocation algorithm. 
  * 
+ * "bestfit", "nextfit" and "addressfit" (address ordered first fit) use the
+ * first fit heap with another search policy (see ff_set_policy).
+ * 
  * ERRORS: errno will be
  *  31: if defined before
- *  22: if algorithm does not match "firstfit" nor "buddy"
+ *  22: if algorithm does not match any of the names
  * 
  * @param algorithm 
- * @return int -1 if not set, 1 if firstfit, 2 if buddy is set.
- */
-int set_algorithm(const char *algorithm)
-{
-    if (alg.is_defined) {
-        errno = EMLINK;
-        return -1;
-    }
-    
-    if (strcasecmp(algorithm, "firstfit") == 0)
-    {
-        alg.is_defined = 1;
-        return 1;
-    } else if (strcasecmp(algorithm, "buddy") == 0)
-    {
-        alg = {
-            2, 
-            &bud_malloc, 
-            &bud_realloc, 
-            &bud_free, 
-            &bud_show_stats, 
-            &bud_set_maximum, 
-            &bud_set_minimum
-        };
-        return 2;
-    } else {
-        errno = EINVAL;
-        return -1;
-    }
-}
+ * @return int -1 if not set, 1 if firstfit, 2 if buddy, 3 if bestfit,
+ *         4 if nextfit, 5 if addressfit is set.
+ */
+int set_algorithm(const char *algorithm);
+
+/**
+ * @brief Set the number of arenas
+ * 
+ * Like the algorithm, it should be set before the first allocation.
+ * 
+ * @see arena_set_count
+ * 
+ * @param count number of arenas (not positive for one arena per CPU)
+ * @return int number of arenas or -1 on error
+ */
+int set_arenas(int count);
+
+/**
+ * @brief Set the mmap threshold
+ * 
+ * Requests of at least `threshold` bytes are not served by the algorithm,
+ * they get their own mapping which is unmapped when they are freed. It is
+ * MAP_DEFAULT_THRESHOLD by default.
+ * 
+ * @param threshold size in bytes, -1 serves every request by the algorithm
+ * @return long the threshold
+ */
+long set_mmap_threshold(long threshold);
+
+/**
+ * @brief Start (or stop) recording the allocations into a trace
+ * 
+ * Every successful my_malloc, my_aligned_alloc, my_realloc and my_free is
+ * written to the file at `path` until the recording is stopped or the
+ * program exits. The trace can be replayed by `tracereplay`.
+ * 
+ * @see trace.h
+ * 
+ * @param path path of the trace file, NULL stops the recording
+ * @return int 0 on success or -1 if the file cannot be opened
+ */
+int set_trace(const char *path);
+
+/**
+ * @brief Set the largest request which is served by the slabs
+ * 
+ * Requests up to `limit` bytes are packed into the slabs (see slab.h) for
+ * both algorithms, bigger ones are served by the algorithm. It is
+ * SLAB_MAX_SIZE by default.
+ * 
+ * @param limit size in bytes, 0 serves every request by the algorithm
+ * @return long the limit (at most SLAB_MAX_SIZE)
+ */
+long set_slab_limit(long limit);
+
+/**
+ * @brief Start (or stop) the debug checks
+ * 
+ * my_free_sized checks that its pointer is an allocated block with at least
+ * `size` usable bytes (with a full lookup of the block) and prints the
+ * mismatch and aborts otherwise. It is disabled by default.
+ * 
+ * @param enabled non zero to enable the checks
+ * @return int 1 if the checks are enabled, 0 otherwise
+ */
+int set_debug(int enabled);
 
 /**
  * @brief Allocates `size` bytes and set every byte with `fill`
  * 
+ * Small requests are served from the cache of the thread or the slabs if
+ * possible and large ones are mapped (see set_mmap_threshold).
+ * 
  * @see bud_malloc
  * @see ff_malloc
  * 
  * @param size size of allocation
- * @param fill filling byte
+ * @param fill filling byte (or NO_FILL, see fill.h)
  * @return void* NULL if allocation failed or pointer to the allocated space
  */
-void* my_malloc(size_t size, int fill)
-{
-    ALG_CHECK;
-    return (*alg.my_malloc)(size, fill);
-}
+void* my_malloc(size_t size, int fill);
 
-void* my_realloc(void* ptr, size_t size, int fill)
-{
-    ALG_CHECK;
-    return (*alg.my_realloc)(ptr, size, fill);
-}
+/**
+ * @brief Allocates `size` bytes at a multiple of `alignment`
+ * 
+ * It does not use the cache of the thread. Large requests are mapped like
+ * my_malloc. The block is freed with my_free.
+ * 
+ * ERRORS: errno will be
+ *  22: if alignment is not a power of two
+ * 
+ * @see bud_aligned_alloc
+ * @see ff_aligned_alloc
+ * 
+ * @param alignment a power of two
+ * @param size size of allocation
+ * @param fill filling byte (or NO_FILL, see fill.h)
+ * @return void* NULL if allocation failed or pointer to the allocated space
+ */
+void* my_aligned_alloc(size_t alignment, size_t size, int fill);
 
-void my_free(void* ptr)
-{
-    ALG_CHECK;
-    (*alg.my_free)(ptr);
-}
+/**
+ * @brief reallocate the pointer with new memory size
+ * 
+ * A mapped block which stays above the mmap threshold is resized with
+ * mremap (see map_realloc), otherwise it is moved to a block of the
+ * algorithm. A block of the algorithm which grows above the threshold is
+ * moved to its own mapping, smaller ones are handled by the algorithm.
+ * 
+ * @see bud_realloc
+ * @see ff_realloc
+ */
+void* my_realloc(void* ptr, size_t size, int fill);
 
-void show_stats()
-{
-    ALG_CHECK;
-    (*alg.show_stats)();
-}
+/**
+ * @brief frees the pointer or keeps it in the cache of the thread
+ * 
+ * @see bud_free
+ * @see ff_free
+ * 
+ * @param ptr pointer to a pre-allocated memory
+ */
+void my_free(void* ptr);
 
-int set_maximum(int value)
-{
-    ALG_CHECK;
-    return (*alg.set_maximum)(value);
-}
+/**
+ * @brief frees a block whose size is known by the caller
+ * 
+ * The size chooses the path of the block, so the lookup of my_free is
+ * skipped: a mapped size goes straight to the mapped blocks, a cacheable
+ * block is cached in the class of its size without reading its header and
+ * the others are freed by the algorithm without validating their header
+ * (see ff_free_sized and bud_free_sized).
+ * 
+ * NOTE: size should be the size given to my_malloc (or my_realloc,
+ * my_aligned_alloc) for the block, or at most its usable size. A bigger size
+ * can hand the block out for a request which does not fit (see set_debug).
+ * 
+ * @param ptr pointer to a pre-allocated memory
+ * @param size the size of the block
+ */
+void my_free_sized(void* ptr, size_t size);
 
-int set_minimum(int value)
-{
-    ALG_CHECK;
-    return (*alg.set_minimum)(value);
-}
+/**
+ * @brief returns the number of usable bytes of an allocated block
+ * 
+ * @param ptr pointer to a pre-allocated memory
+ * @return size_t 0 if ptr is not an allocated block
+ */
+size_t my_usable_size(void* ptr);
+
+/**
+ * @brief Allocates `count` blocks of `size` bytes at once
+ * 
+ * The blocks are taken from the slabs, mapped or given by the batch
+ * allocation of the algorithm, which takes its lock once for all of them.
+ * It does not use the cache of the thread. Each block is freed with my_free
+ * or my_free_batch.
+ * 
+ * @see bud_malloc_batch
+ * @see ff_malloc_batch
+ * 
+ * @param size size of each block
+ * @param count number of blocks
+ * @param out the blocks are stored in out[0], ..., out[count - 1]
+ * @param fill filling byte (or NO_FILL, see fill.h)
+ * @return size_t number of allocated blocks (at the start of out), less than
+ *         count if the allocation failed
+ */
+size_t my_malloc_batch(size_t size, size_t count, void** out, int fill);
+
+/**
+ * @brief frees `count` blocks at once
+ * 
+ * The blocks of the algorithm are freed together (see ff_free_batch and
+ * bud_free_batch) instead of one lock acquisition for each. The blocks are
+ * not kept in the cache of the thread. NULL pointers are ignored.
+ * 
+ * @param ptrs pointers to pre-allocated memory
+ * @param count number of pointers
+ */
+void my_free_batch(void** ptrs, size_t count);
+
+/**
+ * @brief takes every lock of the library before fork
+ * 
+ * The locks of the trace, the arenas of both algorithms, the slab classes
+ * and the mapped blocks are taken in this order, so a thread which holds one
+ * of them at the time of fork has released it before. They are registered
+ * with pthread_atfork by the LD_PRELOAD library (see preload.c).
+ */
+void my_fork_prepare();
+
+/**
+ * @brief releases the locks taken by my_fork_prepare in the parent
+ */
+void my_fork_parent();
+
+/**
+ * @brief initializes the locks taken by my_fork_prepare again in the child
+ * 
+ * The child only has the thread which called fork, so nobody waits for them.
+ */
+void my_fork_child();
+
+void show_stats();
+
+/**
+ * @brief Fills stats with the statistics of the heaps
+ * 
+ * The statistics are kept up to date by every allocation and free, so this
+ * only takes the lock of each arena for a moment and does not walk the
+ * blocks (unlike show_stats). It can be polled often.
+ * 
+ * @see stats.h
+ * 
+ * @param stats statistics to be filled
+ */
+void my_get_stats(struct my_heap_stats *stats);
+
+long set_maximum(long value);
+
+long set_minimum(long value);
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif // _myalloc_H_ guard
\ No newline at end of file
+#endif // _myalloc_H_ guard
@@ -0,0 +1,115 @@
+/*
+ * region.h
+ *
+ * A region is a contiguous piece of address space that grows and shrinks at
+ * its top, like the data segment. It is the memory source of an arena of the
+ * allocation algorithms:
+ *
+ *      - REGION_BRK regions use the program break (sbrk/brk). Only one of
+ *        them (the main arena) should exist, and only if nobody else moves
+ *        the break (see arena_set_brk).
+ *      - REGION_MMAP regions reserve a big range of address space with an
+ *        inaccessible mapping once and make pages accessible as they grow,
+ *        the way glibc builds the heaps of its secondary arenas. As the
+ *        pages are only accounted when they become accessible, RLIMIT_DATA
+ *        limits them just like the program break.
+ *
+ * The memory of a region is in [base, top). The memory after the top is
+ * always zero, so the memory returned by region_grow is zero too. None of
+ * these functions are thread-safe, the owner of the region should serialize
+ * them.
+ */
+
+#pragma once
+
+#ifndef _region_H_
+#define _region_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+
+#define REGION_BRK 1
+#define REGION_MMAP 2
+
+/* alignment of the base of a region (mmap regions are page aligned anyway) */
+#define REGION_ALIGN 4096
+
+/* address space reserved by a REGION_MMAP region */
+#define REGION_RESERVE (1UL << 40)
+
+struct region {
+    int kind;
+    char *base;
+    char *top;
+    /* end of the accessible pages (REGION_MMAP) */
+    char *committed;
+    /* end of the reserved address space (REGION_MMAP) */
+    char *end;
+};
+
+/**
+ * @brief initializes the region (nothing is reserved until the first growth)
+ * 
+ * @param r region
+ * @param kind REGION_BRK or REGION_MMAP
+ */
+void region_init(struct region *r, int kind);
+
+/**
+ * @brief adds size bytes to the top of the region
+ * 
+ * The new memory always starts at the old top. NULL is returned if the region
+ * cannot grow, which is also the case when the program break was moved by
+ * somebody else (e.g. another malloc) since the last growth of a REGION_BRK
+ * region.
+ * 
+ * @param r region
+ * @param size number of bytes
+ * @return void* start of the new memory or NULL on failure
+ */
+void* region_grow(struct region *r, size_t size);
+
+/**
+ * @brief moves the top of the region back to new_top
+ * 
+ * The memory after new_top is given back to the system if possible (and
+ * the part which is kept is cleared). A REGION_BRK region is only shrunk if
+ * the program break is still its top.
+ * 
+ * @param r region
+ * @param new_top new top, it should be in [base, top]
+ * @return int 0 on success and -1 if nothing was done
+ */
+int region_trim(struct region *r, void *new_top);
+
+/**
+ * @brief gives the whole pages in [start, end) back to the system
+ * 
+ * The pages stay accessible, only their memory is released. The whole range
+ * (with the partial pages at its ends) is zero afterwards. It is used for
+ * big free blocks in the middle of a region.
+ * 
+ * @return int 0 on success and -1 if there is no whole page or on failure
+ */
+int region_release(void *start, void *end);
+
+/**
+ * @brief checks whether ptr is inside the memory of the region
+ * 
+ * It can be called without serializing with growth of the region.
+ */
+static inline int region_contains(struct region *r, const void *ptr)
+{
+    char *base = __atomic_load_n(&r->base, __ATOMIC_ACQUIRE);
+    char *top = __atomic_load_n(&r->top, __ATOMIC_ACQUIRE);
+    return base != NULL && (const char *) ptr >= base && (const char *) ptr < top;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
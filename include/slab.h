@@ -0,0 +1,113 @@
+/*
+ * slab.h
+ *
+ * Small objects are not served by the allocation algorithms (see myalloc.h),
+ * whose headers are bigger than the objects themselves. They are packed into
+ * page sized slabs instead: every slab holds objects of a single size class
+ * (a multiple of SLAB_GRANULE) and a bitmap of its free objects, so the
+ * objects have no header at all.
+ *
+ * The slabs are carved from one mmap region (see region.h), so a pointer is
+ * recognized by its address and its slab is the page it is in. Each size
+ * class has its own lock and a list of the slabs with free objects. A slab
+ * which becomes empty is kept for the next allocations of its class, but if
+ * the class already has an empty slab, its pages are given back to the
+ * system and it can be reused by any class.
+ */
+
+#pragma once
+
+#ifndef _slab_H_
+#define _slab_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include "stats.h"
+
+/* size (and alignment) of a slab */
+#define SLAB_SIZE 4096
+
+/* object sizes are multiples of the granule (which is also their alignment) */
+#define SLAB_GRANULE 16
+
+/* largest object */
+#define SLAB_MAX_SIZE 256
+
+/* number of size classes */
+#define SLAB_CLASSES (SLAB_MAX_SIZE / SLAB_GRANULE)
+
+/**
+ * @brief allocates an object of at least `size` bytes
+ *
+ * Objects which were never used are zero, so they are not filled with zero
+ * again.
+ *
+ * @param size size of the request, in (0, SLAB_MAX_SIZE]
+ * @param fill fills allocated size with fill value (or NO_FILL, see fill.h)
+ * @return void* NULL on failure
+ */
+void* slab_alloc(size_t size, int fill);
+
+/**
+ * @brief frees the object if ptr is an allocated object of a slab
+ *
+ * Other pointers and objects which are free already are ignored.
+ *
+ * @param ptr any pointer
+ */
+void slab_free(void* ptr);
+
+/**
+ * @brief returns the object size of the slab of ptr
+ *
+ * ptr should be the start of an object which is allocated, so a pointer
+ * inside an object or an object which is back in its slab (double free) is
+ * not taken for a slab object by my_free and the thread cache.
+ *
+ * @param ptr any pointer
+ * @return size_t 0 if ptr is not an allocated object of a slab
+ */
+size_t slab_usable_size(void* ptr);
+
+/**
+ * @brief sets the largest request which is served by the slabs
+ *
+ * @param limit size in bytes, 0 disables the slabs. It is limited to
+ *              SLAB_MAX_SIZE (which is also the default).
+ * @return long the limit
+ */
+long slab_set_limit(long limit);
+
+/**
+ * @brief returns whether a request of `size` bytes should use the slabs
+ */
+int slab_should_use(size_t size);
+
+/**
+ * @brief adds the memory and the allocated objects of the slabs to stats
+ */
+void slab_get_stats(struct my_heap_stats *stats);
+
+/**
+ * @brief takes every lock of the size classes and of the slab memory (before fork)
+ *
+ * The locks are taken in a fixed order, see my_fork_prepare.
+ */
+void slab_fork_lock();
+
+/**
+ * @brief releases the locks taken by slab_fork_lock (after fork)
+ *
+ * @param child non zero in the child, the locks are initialized again there
+ *              as the threads which may wait for them do not exist
+ */
+void slab_fork_unlock(int child);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
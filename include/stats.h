@@ -0,0 +1,82 @@
+/*
+ * stats.h
+ *
+ * Heap statistics which are kept up to date by every allocation and free,
+ * so reading them does not walk the blocks (see my_get_stats in myalloc.h).
+ */
+
+#pragma once
+
+#ifndef _stats_H_
+#define _stats_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+
+/**
+ * statistics of all of the heaps
+ *
+ * The data bytes of a block are the bytes after its header. Blocks in the
+ * cache of a thread (see tcache.h) and blocks in the remote free queue of an
+ * arena are still in use for the algorithms.
+ */
+struct my_heap_stats {
+    /* data bytes of the allocated blocks */
+    size_t in_use_bytes;
+    /* bytes requested by the user for the allocated blocks */
+    size_t requested_bytes;
+    size_t in_use_blocks;
+    /* data bytes of the free blocks */
+    size_t free_bytes;
+    size_t free_blocks;
+    /* headers and bytes which are not in any block (heap_size - in use - free) */
+    size_t metadata_bytes;
+    /* total size of the heaps of the arenas */
+    size_t heap_size;
+    /* end of the heap of the main arena (the program break if it uses it,
+       see arena_set_brk) */
+    void *heap_top;
+    /* data bytes of the largest free block of any arena (first fit keeps the
+       largest block of each free list, its list is walked again only after
+       that block was taken, see ff_get_stats) */
+    size_t largest_free_block;
+    /* in_use_bytes - requested_bytes */
+    size_t internal_fragmentation;
+    /* blocks mapped directly (see mapped.h), with their headers */
+    size_t mapped_bytes;
+    size_t mapped_blocks;
+    /* slabs of the small objects (see slab.h) and their allocated objects */
+    size_t slab_bytes;
+    size_t slab_objects;
+};
+
+/* counters of an arena, they are updated under the lock of the arena */
+struct heap_counters {
+    size_t in_use_bytes;
+    size_t requested_bytes;
+    size_t in_use_blocks;
+    size_t free_bytes;
+    size_t free_blocks;
+};
+
+/**
+ * @brief adds the counters of an arena to stats
+ */
+static inline void heap_counters_add(struct my_heap_stats *stats,
+                                     const struct heap_counters *counters)
+{
+    stats->in_use_bytes += counters->in_use_bytes;
+    stats->requested_bytes += counters->requested_bytes;
+    stats->in_use_blocks += counters->in_use_blocks;
+    stats->free_bytes += counters->free_bytes;
+    stats->free_blocks += counters->free_blocks;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * tcache.h
+ *
+ * Per-thread cache of recently freed blocks. It sits in front of the
+ * allocation algorithms (see myalloc.h) so that most malloc/free pairs of a
+ * thread are served without taking the lock of the algorithm.
+ *
+ * Cached blocks are still allocated from the point of view of the algorithm.
+ * They are binned by their usable size in classes of TC_GRANULE bytes: bin i
+ * holds blocks with at least i * TC_GRANULE usable bytes, so any block of the
+ * bin of ceil(size / TC_GRANULE) fits a request of `size` bytes.
+ */
+
+#pragma once
+
+#ifndef _tcache_H_
+#define _tcache_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+
+/* width of a bin */
+#define TC_GRANULE 16
+
+/* number of bins (bin 0 is not used) */
+#define TC_CLASSES 64
+
+/* largest request which can be served from the cache */
+#define TC_MAX_SIZE (TC_GRANULE * TC_CLASSES)
+
+/* maximum number of blocks kept in a bin */
+#define TC_BIN_COUNT 32
+
+/**
+ * @brief pops a cached block which can hold `size` bytes
+ * 
+ * @param size size of the request
+ * @return void* NULL if there is no such block in the cache of this thread
+ */
+void* tcache_get(size_t size);
+
+/**
+ * @brief caches a block which is freed by the user
+ * 
+ * The first 16 bytes of the block are used for the cache bookkeeping, so
+ * blocks with less usable bytes are not cached. If the block is already in
+ * the cache of this thread (double free) it is ignored.
+ * 
+ * @param ptr pointer to an allocated block
+ * @param usable number of usable bytes of the block
+ * @param release function used to free the block if the thread exits while
+ *                the block is cached
+ * @return int 1 if the block is taken by the cache, 0 if it should be freed
+ */
+int tcache_put(void* ptr, size_t usable, void (*release)(void*));
+
+/**
+ * @brief frees every block in the cache of this thread
+ * 
+ * It is called automatically when a thread exits.
+ */
+void tcache_flush();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
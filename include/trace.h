@@ -0,0 +1,126 @@
+/*
+ * trace.h
+ *
+ * Optional recording of every allocation made through myalloc.h into a
+ * compact binary trace, which can be replayed later against any algorithm
+ * (see bench/tracereplay.cpp).
+ *
+ * A trace starts with TRACE_MAGIC, followed by trace_record entries. Blocks
+ * are not identified by their address but by an id which is given to them
+ * when they are allocated and kept when they are reallocated, so a replay
+ * only needs a table from ids to its own pointers. Ids start from 1 and
+ * are never reused.
+ *
+ * Only successful operations are recorded. Blocks which were allocated
+ * before the recording started are unknown: freeing them is not recorded
+ * and reallocating them is recorded as a new block.
+ */
+
+#pragma once
+
+#ifndef _trace_H_
+#define _trace_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* first bytes of a trace file */
+#define TRACE_MAGIC "MYALLOC-TRACE-1\n"
+#define TRACE_MAGIC_SIZE 16
+
+/* operations of the trace */
+#define TRACE_MALLOC 1
+#define TRACE_REALLOC 2
+#define TRACE_FREE 3
+
+/* number of records buffered before they are written */
+#define TRACE_BUFFER 4096
+
+/**
+ * entry of a trace (16 bytes)
+ *
+ * The top byte of `info` is the operation (low 2 bits) and the base 2
+ * logarithm of the alignment (the other 6 bits, 0 for the default
+ * alignment), the rest is the size of the request. `delta` is the time
+ * since the previous record in nanoseconds (saturated at UINT32_MAX).
+ */
+struct trace_record {
+    uint64_t info;
+    uint32_t id;
+    uint32_t delta;
+};
+
+#define TRACE_SIZE_BITS 56
+#define TRACE_OP(record) ((int) ((record)->info >> TRACE_SIZE_BITS) & 3)
+#define TRACE_ALIGN_SHIFT(record) ((int) ((record)->info >> (TRACE_SIZE_BITS + 2)))
+#define TRACE_REQUEST(record) ((size_t) ((record)->info & ((1UL << TRACE_SIZE_BITS) - 1)))
+
+/**
+ * @brief starts recording into the file at path (or stops)
+ *
+ * The file is truncated. A running recording is stopped (its records are
+ * written) first.
+ *
+ * @param path path of the trace, NULL only stops the running recording
+ * @return int 0 on success or -1 if the file cannot be opened (errno is set)
+ */
+int trace_open(const char *path);
+
+/**
+ * @brief returns whether a recording is running
+ */
+int trace_active();
+
+/**
+ * @brief records a new block
+ *
+ * @param ptr the block (nothing is recorded if it is NULL)
+ * @param size size of the request
+ * @param alignment alignment of the request, 0 for the default alignment
+ */
+void trace_alloc(void *ptr, size_t size, size_t alignment);
+
+/**
+ * @brief records the free of a block, before it is freed
+ *
+ * It should be called before the block is freed, so the address is not
+ * allocated again (by another thread) while it is still known as ptr.
+ */
+void trace_free(void *ptr);
+
+/**
+ * @brief forgets the id of a block which is about to be reallocated
+ *
+ * @return uint32_t the id of ptr, 0 if it is unknown
+ */
+uint32_t trace_take(void *ptr);
+
+/**
+ * @brief records the reallocation of the block with the `id` (from trace_take)
+ *
+ * If the reallocation failed (new_ptr is NULL) old_ptr keeps its id and
+ * nothing is recorded. An unknown block (id 0) gets a new id.
+ */
+void trace_realloc(uint32_t id, void *old_ptr, void *new_ptr, size_t size);
+
+/**
+ * @brief takes the lock of the trace (before fork)
+ */
+void trace_fork_lock();
+
+/**
+ * @brief releases the lock taken by trace_fork_lock (after fork)
+ *
+ * @param child non zero in the child, the lock is initialized again there
+ */
+void trace_fork_unlock(int child);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
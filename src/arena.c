@@ -0,0 +1,122 @@
+/*
+ * arena.c
+ *
+ * proper documentation is added for each function (mostly in the header file).
+ */
+
+#define _GNU_SOURCE
+#include "arena.h"
+#include "region.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+
+static int arena_count = 1;
+
+/* whether arena 0 uses the program break (see arena_set_brk) */
+static int arena_brk = 0;
+
+/* whether any thread is bound to an arena */
+static int arena_used = 0;
+
+/* next arena for round-robin binding */
+static unsigned arena_next = 0;
+
+/* index of the arena of this thread plus one (zero when it is not bound) */
+static __thread int thread_arena = 0;
+
+
+int arena_set_count(int count)
+{
+    if (__atomic_load_n(&arena_used, __ATOMIC_ACQUIRE))
+    {
+        errno = EMLINK;
+        return -1;
+    }
+
+    if (count <= 0)
+    {
+        // sched_getcpu can return any configured CPU (see arena_per_cpu)
+        count = sysconf(_SC_NPROCESSORS_CONF);
+    }
+    if (count < 1)
+    {
+        count = 1;
+    } else if (count > MAX_ARENAS) {
+        count = MAX_ARENAS;
+    }
+    __atomic_store_n(&arena_count, count, __ATOMIC_RELEASE);
+    return count;
+}
+
+
+int arena_set_brk(int enabled)
+{
+    if (__atomic_load_n(&arena_used, __ATOMIC_ACQUIRE))
+    {
+        errno = EMLINK;
+        return -1;
+    }
+    __atomic_store_n(&arena_brk, enabled != 0, __ATOMIC_RELEASE);
+    return enabled != 0;
+}
+
+
+int arena_region_kind(int index)
+{
+    return index == 0 && __atomic_load_n(&arena_brk, __ATOMIC_ACQUIRE) ? REGION_BRK : REGION_MMAP;
+}
+
+
+int arena_get_count()
+{
+    return __atomic_load_n(&arena_count, __ATOMIC_ACQUIRE);
+}
+
+
+/**
+ * @brief binds the calling thread to an arena in round-robin order
+ */
+static int arena_bind()
+{
+    __atomic_store_n(&arena_used, 1, __ATOMIC_RELEASE);
+    unsigned next = __atomic_fetch_add(&arena_next, 1, __ATOMIC_RELAXED);
+    return next % arena_get_count();
+}
+
+
+/**
+ * @brief checks whether there is an arena for every CPU
+ * 
+ * In that case the arena of the CPU that the thread is running on is used
+ * for every allocation. Otherwise CPU numbers would map several busy threads
+ * to the same arena, so threads stay on their round-robin arena.
+ */
+static int arena_per_cpu()
+{
+    static int per_cpu = -1;
+    if (per_cpu == -1)
+    {
+        per_cpu = arena_get_count() >= sysconf(_SC_NPROCESSORS_CONF);
+    }
+    return per_cpu;
+}
+
+
+int arena_index()
+{
+    if (thread_arena == 0)
+    {
+        thread_arena = arena_bind() + 1;
+    }
+    if (arena_per_cpu())
+    {
+        int cpu = sched_getcpu();
+        if (cpu >= 0)
+        {
+            return cpu % arena_get_count();
+        }
+    }
+    return thread_arena - 1;
+}
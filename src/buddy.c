@@ -2,7 +2,11 @@
 // https://opensource.org/licenses/MIT
 
 #include "buddy.h"
+#include "arena.h"
+#include "region.h"
 #include <string.h>
+#include <stdio.h>
+#include <pthread.h>
 
 #define MIN(a,b)             \
 ({                           \
@@ -18,7 +22,30 @@
     _a > _b ? _a : _b;       \
 })
 
-bud_meta head = NULL;
+/* seed of the header checksums */
+#define BUD_MAGIC 0xb0dd1e5a110c8edUL
+
+/* seed of the checksums of aligned block tags */
+#define BUD_TAG_MAGIC 0x7a9b0dd1e5a11600UL
+
+/* fields of the info of a block */
+#define BUD_FREE 1UL
+#define BUD_ZERO 2UL
+#define BUD_ORDER_SHIFT 2
+#define BUD_ALIGN_SHIFT 8
+#define BUD_REQUEST_SHIFT 16
+#define BUD_FIELD_MASK 63UL
+
+/**
+ * @brief tag right before the data of a block from bud_aligned_alloc
+ * 
+ * The data of such a block is not right after its header, so the tag points
+ * back to the header.
+ */
+struct bud_tag {
+    bud_meta block;
+    uintptr_t magic;
+};
 
 /** Initial Min limit (no limit) */
 long min_limit = 0;
@@ -26,225 +53,517 @@ long min_limit = 0;
 /** initial Max limit (no limit) */
 long max_limit = -1;
 
-size_t sum_allocated = 0;
+/** size of free blocks whose pages are released (-1 for never) */
+static long release_threshold = BUD_RELEASE_THRESHOLD;
+
+/** order of the chunks the heaps grow by (see bud_set_max_order) */
+static int max_order = BUD_MAX_ORDER;
 
+/** serializes changes of the limits */
+static pthread_mutex_t limits_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /**
- * @brief return the smallest power of two value greater than x ([1], p 48)
+ * @brief an independent buddy heap (see arena.h)
  * 
- * Other methods was possible for this work like using A32 builtin bit scan 
- * revers (bsr) instruction or using mathematical approach with logarithms and
- * ceiling.
+ * The heap is the whole memory of the region. It starts with the first block
+ * (head) and doubles until it is one chunk (2^max_order bytes), then it grows
+ * by a chunk at a time. Every chunk is a separate buddy tree, blocks are not
+ * merged above the chunk size. A request which does not fit in a chunk gets
+ * a top level block of its own order instead.
+ */
+struct bud_arena {
+    /** protects every block header and the rest of the arena */
+    pthread_mutex_t lock;
+    struct region heap;
+    /** heads of the per-order free lists */
+    bud_meta free_lists[BUD_ORDERS];
+    /** bit i is set when free_lists[i] is not empty */
+    unsigned long order_map;
+    /** blocks freed by threads of other arenas, linked by next */
+    bud_meta remote_frees;
+    /** the free bytes and blocks are counted by the free lists */
+    struct heap_counters counters;
+};
+
+static struct bud_arena arenas[MAX_ARENAS];
+static pthread_once_t arenas_once = PTHREAD_ONCE_INIT;
+
+static void init_arenas()
+{
+    for (int i = 0; i < MAX_ARENAS; i++)
+    {
+        pthread_mutex_init(&arenas[i].lock, NULL);
+        region_init(&arenas[i].heap, arena_region_kind(i));
+    }
+}
+
+/**
+ * @brief returns the arena of the calling thread
+ */
+static struct bud_arena* thread_arena()
+{
+    pthread_once(&arenas_once, &init_arenas);
+    return &arenas[arena_index()];
+}
+
+/**
+ * @brief returns the arena whose heap contains ptr
+ * 
+ * It can be called without holding any lock.
  * 
- * [1] Baxter, Michael. "hacker's delight." Linux Journal 2003.108 (2003).
- *
+ * @return struct bud_arena* NULL if ptr is not in any arena
  */
-static __attribute__((noinline)) unsigned next_pow2(unsigned x)
+static struct bud_arena* owner_of(void *ptr)
 {
-	x -= 1;
-	x |= (x >> 1);
-	x |= (x >> 2);
-	x |= (x >> 4);
-	x |= (x >> 8);
-	x |= (x >> 16);
-	
-	return x + 1;
+    int count = arena_get_count();
+    for (int i = 0; i < count; i++)
+    {
+        if (region_contains(&arenas[i].heap, ptr))
+            return &arenas[i];
+    }
+    return NULL;
+}
+
+/** first block of the heap, every block offset is relative to it */
+static inline bud_meta head_of(struct bud_arena *a)
+{
+    return (bud_meta) a->heap.base;
+}
+
+/** size of the heap */
+static inline size_t sum_allocated(struct bud_arena *a)
+{
+    return a->heap.top - a->heap.base;
 }
 
 
 /**
- * @brief Splits the block into half
+ * @brief return the smallest power of two value not less than x
  * 
- * When we are splitting, it will take the block into two headers and adjust
- * the depth and the Rightness of it.
+ * The bit scan reverse (bsr/lzcnt) of x - 1 gives the position of its highest
+ * bit, so it takes constant time for every 64 bit size.
  * 
- * NOTE: we know that the size is a power of two. We also know that split will
- * not happen for sizes less than 128 bytes (because the minimum request will
- * be 64).
+ * NOTE: x should be at most 2^63.
+ */
+static inline size_t next_pow2(size_t x)
+{
+    return x <= 1 ? 1 : 1UL << (64 - __builtin_clzll(x - 1));
+}
+
+/**
+ * @brief returns the order (log2) of a power of two size
+ */
+static inline int order_of(size_t size)
+{
+    return __builtin_ctzl(size);
+}
+
+/** order of the block */
+static inline int block_order(bud_meta bm)
+{
+    return (bm->info >> BUD_ORDER_SHIFT) & BUD_FIELD_MASK;
+}
+
+/** size of the block (with its header) */
+static inline size_t block_size(bud_meta bm)
+{
+    return 1UL << block_order(bm);
+}
+
+static inline void set_order(bud_meta bm, int order)
+{
+    bm->info = (bm->info & ~(BUD_FIELD_MASK << BUD_ORDER_SHIFT))
+        | (size_t) order << BUD_ORDER_SHIFT;
+}
+
+static inline int block_is_free(bud_meta bm)
+{
+    return (bm->info & BUD_FREE) != 0;
+}
+
+static inline int block_is_zero(bud_meta bm)
+{
+    return (bm->info & BUD_ZERO) != 0;
+}
+
+/** size requested by the user for the allocated block */
+static inline size_t block_request(bud_meta bm)
+{
+    return bm->info >> BUD_REQUEST_SHIFT;
+}
+
+static inline void set_request(bud_meta bm, size_t request)
+{
+    bm->info = (bm->info & ((1UL << BUD_REQUEST_SHIFT) - 1))
+        | request << BUD_REQUEST_SHIFT;
+}
+
+
+/**
+ * @brief pushes the FREE block to the head of the free list of its order
  * 
+ * @param bm a FREE block which is not in any free list
+ */
+void list_insert(struct bud_arena *a, bud_meta bm)
+{
+    int order = block_order(bm);
+    bm->prev = NULL;
+    bm->next = a->free_lists[order];
+    if (bm->next != NULL)
+    {
+        bm->next->prev = bm;
+    }
+    a->free_lists[order] = bm;
+    a->order_map |= 1UL << order;
+    a->counters.free_bytes += block_size(bm) - BUD_BLOCK_SIZE;
+    a->counters.free_blocks++;
+}
+
+
+/**
+ * @brief unlinks the FREE block from the free list of its order
  * 
- * @param b the block that will be splitted - should be a valid block
+ * @param bm a FREE block which is in a free list
  */
-void split (bud_meta b)
+void list_remove(struct bud_arena *a, bud_meta bm)
 {
-    size_t half_size = b->size / 2;
-    if (b->size <= 64)
-        return;
+    int order = block_order(bm);
+    if (bm->prev != NULL)
+    {
+        bm->prev->next = bm->next;
+    } else {
+        a->free_lists[order] = bm->next;
+    }
+    if (bm->next != NULL)
+    {
+        bm->next->prev = bm->prev;
+    }
+    if (a->free_lists[order] == NULL)
+    {
+        a->order_map &= ~(1UL << order);
+    }
+    bm->next = bm->prev = NULL;
+    a->counters.free_bytes -= block_size(bm) - BUD_BLOCK_SIZE;
+    a->counters.free_blocks--;
+}
+
 
-    // find header
-    bud_meta next_half = (bud_meta)((void *) b + half_size);
+/**
+ * @brief returns the buddy of the block
+ * 
+ * Every block of size 2^k starts at an offset (from the head) which is a
+ * multiple of 2^k, so flipping the kth bit of the offset gives the other half
+ * of the parent block.
+ * 
+ * NOTE: the buddy may be out of the heap (after its top).
+ */
+static inline bud_meta buddy_of(struct bud_arena *a, bud_meta bm)
+{
+    size_t offset = (size_t)((char *) bm - a->heap.base);
+    return (bud_meta)(a->heap.base + (offset ^ block_size(bm)));
+}
 
-    // adjust sizes
-    next_half->size = b->size = half_size;
 
-    // adjust depth and rightness
-    next_half->depth = (b->depth += 1); 
-    next_half->rightness = next_half->rightness << 1 + 1;
-    b->rightness <<= 1;
-    
-    // adjust the links
-    next_half->prev = b;
-    next_half->next = b->next;
-    b->next = next_half;
+/**
+ * @brief returns the checksum of the header of bm
+ */
+static inline uintptr_t checksum(bud_meta bm)
+{
+    return BUD_MAGIC ^ (uintptr_t) bm ^ bm->info;
+}
 
-    // adjust the ptr
-    next_half->ptr = &next_half->data;
 
-    // adjust freeness
-    next_half->is_free = 1;
+/**
+ * @brief updates the checksum of bm
+ * 
+ * It should be called whenever a block is allocated or the info of an
+ * allocated block changes.
+ */
+static inline void seal(bud_meta bm)
+{
+    bm->magic = checksum(bm);
+}
+
+
+/**
+ * @brief returns the checksum of the tag of ptr which points to bm
+ */
+static inline uintptr_t tag_checksum(bud_meta bm, void *ptr)
+{
+    return BUD_TAG_MAGIC ^ (uintptr_t) ptr ^ (uintptr_t) bm;
+}
+
+
+/**
+ * @brief takes the ownership of the allocated block for freeing it
+ * 
+ * The checksum is cleared atomically, so of many concurrent frees of the same
+ * block exactly one succeeds and the others see an invalid block.
+ * 
+ * @return int 1 if the caller should free the block and 0 otherwise
+ */
+static inline int claim(bud_meta bm)
+{
+    uintptr_t sum = checksum(bm);
+    return __atomic_compare_exchange_n(&bm->magic, &sum, 0, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * @brief pushes the claimed block to the remote free queue of its arena
+ * 
+ * It is lock-free, the block will be freed by the next allocation of the
+ * arena (see drain).
+ */
+static void push_remote(struct bud_arena *a, bud_meta bm)
+{
+    bud_meta head = __atomic_load_n(&a->remote_frees, __ATOMIC_RELAXED);
+    do
+    {
+        bm->next = head;
+    } while (!__atomic_compare_exchange_n(&a->remote_frees, &head, bm, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+
+/**
+ * @brief initializes a FREE block header at mem with given size
+ * 
+ * @param zero whether the data of the block is zero
+ */
+static bud_meta make_block(void *mem, size_t size, int zero)
+{
+    bud_meta header = (bud_meta) mem;
+    header->info = (size_t) order_of(size) << BUD_ORDER_SHIFT | BUD_FREE
+        | (zero ? BUD_ZERO : 0);
+    header->magic = 0;
+    header->next = NULL;
+    header->prev = NULL;
+    return header;
 }
 
 
 /**
- * @brief combines two block together
+ * @brief Splits the block into half
+ * 
+ * The right half becomes a new FREE block which is pushed to the free list of
+ * its order. The left half stays at b.
+ * 
+ * NOTE: we know that the size is a power of two. We also know that split will
+ * not happen for sizes less than 128 bytes (because the minimum request will
+ * be 64).
  * 
- * It should remove the right header from the list, update the depth and 
- * rightness of it. 
  * 
- * @param left 
- * @param right 
+ * @param a the arena of the block
+ * @param b the block that will be splitted - should be a valid block which
+ *          is not in any free list
  */
-void fuse(bud_meta left, bud_meta right)
+void split (struct bud_arena *a, bud_meta b)
 {
-    left->next = right->next;
-    left->size = left->size * 2;
-    left->depth -= 1;
-    left->rightness >>= 1;
+    size_t half_size = block_size(b) / 2;
+    if (half_size < 64)
+        return;
+
+    set_order(b, block_order(b) - 1);
+    list_insert(a, make_block((void *) b + half_size, half_size, block_is_zero(b)));
 }
 
 
 /**
  * @brief Try to coalesce is_free blocks as much as possible
  * 
- * This function will check if a fusion is possible:
- *  - if it's left (right) child it will check if right (left) child is free and
- *    if it was, a merge will happen between these two. if succeeded, it will
- *    call the function recursively to merge with the other one.
+ * While the buddy of the block is a whole free block (same size), it will be
+ * removed from its free list and merged with the block. The result is
+ * pushed to the free list of its order. Blocks are only merged up to the size
+ * of a chunk.
  * 
- * @param bm newly freed block.
+ * @param a the arena of the block
+ * @param bm newly freed block (not in any free list).
+ * @return the merged block
  */
-void coalesce(bud_meta bm)
+bud_meta coalesce(struct bud_arena *a, bud_meta bm)
 {
-    if (bm->rightness & 1 && bm->is_free) // if it's right child 
+    size_t heap_size = sum_allocated(a);
+    size_t chunk_size = 1UL << __atomic_load_n(&max_order, __ATOMIC_RELAXED);
+    while (block_size(bm) < chunk_size)
     {
-        bud_meta left = bm->prev;
-        if (left != NULL && left->is_free && left->depth == bm->depth)
+        bud_meta buddy = buddy_of(a, bm);
+        if ((char *) buddy - a->heap.base + block_size(bm) > heap_size
+            || !block_is_free(buddy) || block_size(buddy) != block_size(bm))
+            break;
+        list_remove(a, buddy);
+        if (buddy < bm)
         {
-            fuse(left, bm);
-            coalesce(left);
+            bud_meta right = bm;
+            bm = buddy;
+            buddy = right;
         }
-    } else {
-        bud_meta right = bm->next;
-        if (right != NULL && right->is_free && right->depth == bm->depth)
-        {
-            fuse(bm, right);
-            coalesce(bm);
+        if (block_is_zero(bm) && block_is_zero(buddy))
+        { // the header and the links of the right half are the only part
+          // which is not zero
+            memset(buddy, 0, BUD_BLOCK_SIZE + 2 * sizeof(bud_meta));
+        } else {
+            bm->info &= ~BUD_ZERO;
         }
+        set_order(bm, block_order(bm) + 1);
     }
+    list_insert(a, bm);
+    return bm;
+}
+
+/**
+ * @brief returns the data of the allocated block (the pointer of the user)
+ * 
+ * The data of a block from bud_aligned_alloc is at the first multiple of its
+ * alignment after the header and the tag.
+ */
+static inline void* data_of(bud_meta bm)
+{
+    int shift = (bm->info >> BUD_ALIGN_SHIFT) & BUD_FIELD_MASK;
+    if (shift == 0)
+        return bm->data;
+    uintptr_t alignment = 1UL << shift;
+    uintptr_t start = (uintptr_t) bm + BUD_BLOCK_SIZE + sizeof(struct bud_tag);
+    return (void *) ((start + alignment - 1) & ~(alignment - 1));
+}
+
+/**
+ * @brief checks that header is an allocated block whose data is at ptr
+ * 
+ * The header should be inside the heap at an offset which is a multiple of
+ * the minimum block size, and it should have a valid checksum, a size that
+ * its offset is aligned to and its data should be at ptr.
+ * 
+ * @return bud_meta NULL if it is not such a block
+ */
+static bud_meta valid_block(bud_meta start, size_t heap_size, void *header, void *ptr)
+{
+    size_t offset = (size_t)((char *) header - (char *) start);
+    if (offset >= heap_size || offset % 64)
+        return NULL;
+
+    bud_meta block = (bud_meta) header;
+    if (block->magic != checksum(block) || block_is_free(block) || block_order(block) < 6
+        || (offset & (block_size(block) - 1))
+        || block_size(block) > heap_size - offset || data_of(block) != ptr)
+        return NULL;
+
+    return block;
 }
 
 /**
  * @brief Get the block object corresponding to ptr
  * 
- * iterates over headers and return the block if it has matching prt
+ * ptr is not trusted: it should be inside the heap and either the header
+ * BUD_BLOCK_SIZE bytes behind it or the header which its tag points to (for
+ * aligned blocks) should be valid (see valid_block). As ptr is checked to be
+ * in the heap, reading the header or the tag cannot cause a fault, so this
+ * is done in constant time without walking the blocks.
+ * 
+ * The header of an allocated block is only changed by its owner, so this can
+ * be called without holding the lock of the arena (but the block may be
+ * freed concurrently if the caller does not own it).
  * 
+ * @param a the arena of the block (it can be NULL)
  * @param p start of allocated memory
- * @return s_block_ptr 
+ * @return bud_meta NULL if p is not the start of an allocated block
  */
-bud_meta get_block (void *ptr)
+bud_meta get_block (struct bud_arena *a, void *ptr)
 {
-    bud_meta block = head;
-    while (block)
+    if (a == NULL || ptr == NULL)
+        return NULL;
+
+    bud_meta start = (bud_meta) __atomic_load_n(&a->heap.base, __ATOMIC_ACQUIRE);
+    size_t heap_size = __atomic_load_n(&a->heap.top, __ATOMIC_ACQUIRE) - (char *) start;
+    if (start == NULL || ptr < (void *) start->data
+        || (char *) ptr >= (char *) start + heap_size)
+        return NULL;
+
+    bud_meta block = valid_block(start, heap_size, (char *) ptr - BUD_BLOCK_SIZE, ptr);
+    if (block == NULL)
     {
-        if (block->ptr == ptr) 
-            return block;
-        block = block->next;
+        struct bud_tag *tag = (struct bud_tag *) ptr - 1;
+        if (tag->magic == tag_checksum(tag->block, ptr))
+            block = valid_block(start, heap_size, tag->block, ptr);
     }
+    return block;
+}
 
-    // if nothing found
-    return NULL;
+/**
+ * @brief returns the number of bytes from ptr to the end of its block
+ */
+static inline size_t usable_of(bud_meta bm, void *ptr)
+{
+    return (char *) bm + block_size(bm) - (char *) ptr;
 }
 
 /**
- * @brief double the size of the heap allocated by now
- * 
- * This functions double the memory we had allocated previously (sum_allocated)
- * and update the depth of the depth of previous data.
+ * @brief adds one block to the top of the heap
  * 
- * NOTE: each time we extend the heap, depth of all blocks should be increased
- * by one.
+ * Every block is aligned to its size, so the new block is at most as big as
+ * the alignment of the top. A heap smaller than a chunk is doubled (the new
+ * block is the buddy of the whole previous heap), otherwise a chunk is added.
+ * A request bigger than a chunk gets a block of its size, the memory up to
+ * its alignment is added with it (in one growth, so nothing is added if the
+ * block cannot be) and becomes free chunks.
  * 
- * NOTE: since we are adding the newly block to the right, we don't need to
- * update the rightness of the metadata.
+ * Only the new blocks are touched, so the cost does not depend on the size of
+ * the heap.
  * 
- * @param last the last element of the block lists.
- * @param s size to be allocated
+ * @param a the arena whose heap is extended
+ * @param size size of the block which is needed (a power of two)
  * @return NULL on failure and a pointer to the newly allocated(expanded) block
  */
-bud_meta extend_heap ()
+bud_meta extend_heap (struct bud_arena *a, size_t size)
 {
-    void* mem;
-    mem = (void *) sbrk(sum_allocated);
-    if (mem == (void *) -1)
+    size_t heap_size = sum_allocated(a);
+    size_t chunk_size = 1UL << __atomic_load_n(&max_order, __ATOMIC_RELAXED);
+    size_t grow = MIN(heap_size & -heap_size, chunk_size);
+    size_t padding = 0;
+    if (size > chunk_size)
     {
-        return NULL;
+        grow = size;
+        padding = -heap_size & (size - 1);
     }
+    if (padding > SIZE_MAX - grow)
+        return NULL;
 
-    bud_meta header = (bud_meta) mem;
-
-    // increment the depth of previous
-    bud_meta prev, block = head;
-    while (block)
+    char* mem = region_grow(&a->heap, padding + grow);
+    if (mem == NULL)
     {
-        block->depth += 1;
-        prev = block;
-        block = block->next;
+        return NULL;
     }
 
-    // define the new block header
-    header->size = sum_allocated;
-    header->is_free = 1;
-    header->rightness = 1;
-    header->depth = 1;
-    header->ptr = &header->data;
-
-    // adjust the links
-    header->next = NULL;
-    header->prev = prev;
-    prev->next = header;
-
-    sum_allocated <<= 1;
-
-    return header;
+    // memory after the top of the region is zero (see region.h)
+    for (char *end = mem + padding; mem < end; )
+    {
+        size_t offset = mem - a->heap.base;
+        size_t s = MIN(offset & -offset, chunk_size);
+        coalesce(a, make_block(mem, s, 1));
+        mem += s;
+    }
+    return coalesce(a, make_block(mem, grow, 1));
 }
 
 /**
  * @brief Initializes the heap by size given to it
  * 
+ * @param a the arena whose heap is initialized
  * @param s size of allocation
  * @return bud_meta 
  */
-bud_meta init_heap(size_t size)
+bud_meta init_heap(struct bud_arena *a, size_t size)
 {
-    void* mem;
-    mem = (void *) sbrk(size);
+    void* mem = region_grow(&a->heap, size);
     
-    if (mem == (void*) -1)
+    if (mem == NULL)
     {
         return NULL; // couldn't allocate
     } 
     
-    bud_meta header = (bud_meta) mem;
-    header->size = size;
-    header->is_free = 1;
-    header->next = NULL;
-    header->prev = NULL;
-    header->depth = 0;
-    header->rightness = 0;
-    header->ptr = &header->data;
-    head = header;
-
-    sum_allocated = size;
+    bud_meta header = make_block(mem, size, 1);
+    list_insert(a, header);
 
     return header;
 }
@@ -253,42 +572,30 @@ bud_meta init_heap(size_t size)
 /**
  * @brief Get the smallest fit of the data or find smallest to split
  * 
+ * returns the head of the first non-empty free list with order of at least
+ * order of `size`.
+ * 
+ * @param a the arena to search in
  * @param size 
- * @return bud_meta 
+ * @return bud_meta NULL if there is no big enough free block
  */
-bud_meta get_best_fit(size_t size)
+bud_meta get_best_fit(struct bud_arena *a, size_t size)
 {
-    bud_meta block = head;
-    bud_meta best = NULL;
-    while (block)
-    {
-        if (block->is_free)
-        {
-            if (block->size == size)
-            {
-                return block;
-            }
-            else if (block->size > size 
-                     && (best == NULL || best->size > block->size))
-            {
-                best = block;
-            }
-        }
-        
-        block = block->next;
-    }
-
-    return best;
+    int order = order_of(size);
+    unsigned long fits = order < BUD_ORDERS ? a->order_map >> order : 0;
+    if (fits == 0)
+        return NULL;
+    return a->free_lists[order + __builtin_ctzl(fits)];
 }
 
-bud_meta shrink_to_size(bud_meta bm, size_t size)
+bud_meta shrink_to_size(struct bud_arena *a, bud_meta bm, size_t size)
 {
-    if (bm->size < size) {
+    if (block_size(bm) < size) {
         return NULL;
     } else {
-        while (bm->size > size)
+        while (block_size(bm) > size)
         {
-            split(bm);
+            split(a, bm);
         }
         return bm;
     }
@@ -299,61 +606,355 @@ bud_meta shrink_to_size(bud_meta bm, size_t size)
  * 
  * for more information see the bud_malloc documentation
  * 
+ * @param a the arena to allocate from
  * @param size size to get
  * @return bud_meta NULL if couldn't else a pointer to header of *free* data
+ *         which is not in any free list
  */
-bud_meta alloc_block(size_t size)
+bud_meta alloc_block(struct bud_arena *a, size_t size)
 {
-    
-    if (head == NULL)
-    { // if no allocation before this extend the heap
-        return init_heap(size);
-    } 
-    else 
-    { /* find the best fit block and if not found extend the heap
-         extension is done until it */
-        bud_meta best_fit = get_best_fit(size);
-        if (best_fit != NULL)
-        {
-            return shrink_to_size(best_fit, size);
-        } else { // no fitted block found, we should extend the heap
-            bud_meta last_extended;
-            do
-            {
-                last_extended = extend_heap();
-                if (last_extended == NULL)
-                    return NULL;
-            } while (sum_allocated/2 < size);
-            // shrink the new allocated heap to the size we wanted
-            return shrink_to_size(last_extended, size);
-        }
+    if (a->heap.base == NULL && init_heap(a, size) == NULL)
+    { // if no allocation before this, initialize the heap
+        return NULL;
+    }
+
+    /* find the best fit block and if not found extend the heap until there
+       is one */
+    bud_meta best_fit;
+    while ((best_fit = get_best_fit(a, size)) == NULL)
+    {
+        if (extend_heap(a, size) == NULL)
+            return NULL;
     }
+    list_remove(a, best_fit);
+    // shrink the found block to the size we wanted
+    return shrink_to_size(a, best_fit, size);
 }
 
-void* bud_malloc(size_t size, int fill)
+/**
+ * @brief checks the size of a request against the limits
+ */
+static int in_limits(size_t size)
+{
+    long min = __atomic_load_n(&min_limit, __ATOMIC_RELAXED);
+    long max = __atomic_load_n(&max_limit, __ATOMIC_RELAXED);
+    // the minimum is never negative and the maximum is -1 or positive
+    return size >= (size_t) min && (max == -1 || size <= (size_t) max) && size <= BUD_MAX_REQUEST;
+}
+
+/**
+ * @brief finds a block for `size` bytes and marks it allocated
+ * 
+ * The block will have `head` bytes in front of the data (at least
+ * BUD_BLOCK_SIZE for its header).
+ * 
+ * NOTE: the lock of the arena should be held.
+ * 
+ * @param zero set to whether the data of the block is zero
+ * @return bud_meta NULL if size is not acceptable or on failure
+ */
+static bud_meta bud_alloc(struct bud_arena *a, size_t size, size_t head, int *zero)
 {
     // if it violates the boundaries
-    if (size < min_limit || (max_limit != -1 && size > max_limit))
+    if (!in_limits(size))
     {
         return NULL;
     }
-    size_t request = next_pow2(BUD_BLOCK_SIZE + size);
-    bud_meta bbp = alloc_block(request);
+    size_t request = MAX(next_pow2(head + size), 64U);
+    bud_meta bbp = alloc_block(a, request);
+    if (bbp != NULL) 
+    {
+        *zero = block_is_zero(bbp);
+        if (*zero)
+        { // the links of the free block were not zero
+            memset(bbp->data, 0, 2 * sizeof(bud_meta));
+        }
+        bbp->info = (size_t) block_order(bbp) << BUD_ORDER_SHIFT;
+        set_request(bbp, size);
+        seal(bbp);
+        a->counters.in_use_bytes += block_size(bbp) - BUD_BLOCK_SIZE;
+        a->counters.requested_bytes += size;
+        a->counters.in_use_blocks++;
+    }
+    return bbp;
+}
+
+/**
+ * @brief returns the block which ends at `end`
+ * 
+ * Blocks are aligned to their size, so the block before `end` is found by
+ * descending from the biggest aligned range which ends there. The start of
+ * that range cannot be inside another block (the block would cross `end`)
+ * and neither can the start of the right half of a range which is split.
+ * 
+ * @param end the start of a block or the top of the heap (not the base)
+ */
+static bud_meta block_before(struct bud_arena *a, char *end)
+{
+    int order = __builtin_ctzl(end - a->heap.base);
+    bud_meta bm = (bud_meta)(end - (1UL << order));
+    while (block_order(bm) < order)
+    {
+        order--;
+        bm = (bud_meta)(end - (1UL << order));
+    }
+    return bm;
+}
+
+/**
+ * @brief shrinks the heap while its top block is free
+ * 
+ * The heap keeps at least its first block. If the region cannot be shrunk
+ * (the program break was moved by someone else) the heap is kept as is.
+ * 
+ * @param a the arena whose heap is trimmed
+ */
+static void trim_heap(struct bud_arena *a)
+{
+    while (a->heap.top > a->heap.base)
+    {
+        bud_meta top = block_before(a, a->heap.top);
+        if (top == head_of(a) || !block_is_free(top))
+            break;
+        list_remove(a, top);
+        if (region_trim(&a->heap, top) == -1)
+        {
+            list_insert(a, top);
+            break;
+        }
+    }
+}
+
+
+/**
+ * @brief gives the memory of a big free block back to the system
+ * 
+ * The heap is trimmed if the block is at its top, otherwise only the pages
+ * after the header of the block are released.
+ * 
+ * @param a the arena of the block
+ * @param bm a FREE block which is in a free list
+ */
+static void release_pages(struct bud_arena *a, bud_meta bm)
+{
+    long threshold = __atomic_load_n(&release_threshold, __ATOMIC_RELAXED);
+    if (threshold == -1 || block_size(bm) < (size_t) threshold)
+        return;
+
+    trim_heap(a);
+    // a zero block was never used or is released already, the links stay
+    if ((char *) bm < a->heap.top && !block_is_zero(bm)
+        && region_release(bm->data + 2 * sizeof(bud_meta), (char *) bm + block_size(bm)) == 0)
+    {
+        bm->info |= BUD_ZERO;
+    }
+}
+
+
+void free_block(struct bud_arena *a, bud_meta bm)
+{
+    a->counters.in_use_bytes -= block_size(bm) - BUD_BLOCK_SIZE;
+    a->counters.requested_bytes -= block_request(bm);
+    a->counters.in_use_blocks--;
+    bm->info = (size_t) block_order(bm) << BUD_ORDER_SHIFT | BUD_FREE;
+    release_pages(a, coalesce(a, bm));
+}
+
+
+/**
+ * @brief frees the blocks of the remote free queue of the arena
+ * 
+ * The whole queue is detached with one exchange, so the remote frees are
+ * handled in a batch under a single acquisition of the lock.
+ * 
+ * NOTE: the lock of the arena should be held.
+ */
+static void drain(struct bud_arena *a)
+{
+    if (__atomic_load_n(&a->remote_frees, __ATOMIC_RELAXED) == NULL)
+        return;
+
+    bud_meta bm = __atomic_exchange_n(&a->remote_frees, NULL, __ATOMIC_ACQUIRE);
+    while (bm != NULL)
+    {
+        bud_meta next = bm->next;
+        bm->next = NULL;
+        free_block(a, bm);
+        bm = next;
+    }
+}
+
+
+/**
+ * @brief frees the allocated block of the arena owner
+ * 
+ * If the owner is the arena of the calling thread (a), the block is freed
+ * right away. Otherwise the lock of the owner is not taken, the block is
+ * pushed to its remote free queue instead.
+ * 
+ * @return int 0 if the block is not allocated (it cannot be claimed)
+ */
+static int release(struct bud_arena *a, struct bud_arena *owner, bud_meta bm)
+{
+    if (!claim(bm))
+        return 0;
+
+    if (owner != a)
+    {
+        push_remote(owner, bm);
+        return 1;
+    }
+
+    pthread_mutex_lock(&owner->lock);
+    free_block(owner, bm);
+    pthread_mutex_unlock(&owner->lock);
+    return 1;
+}
+
+
+void* bud_malloc(size_t size, int fill)
+{
+    struct bud_arena *a = thread_arena();
+    pthread_mutex_lock(&a->lock);
+    drain(a);
+    int zero;
+    bud_meta bbp = bud_alloc(a, size, BUD_BLOCK_SIZE, &zero);
+    pthread_mutex_unlock(&a->lock);
     if (bbp == NULL) 
     {
         return NULL;
     } else {
-        bbp->is_free = 0;
-        memset(bbp->ptr, fill, request - BUD_BLOCK_SIZE);
-        return bbp->ptr;
+        // the block is ours now, it can be filled without the lock
+        fill_memory(bbp->data, fill, block_size(bbp) - BUD_BLOCK_SIZE, zero);
+        return bbp->data;
     }
 }
 
 
-void free_block(bud_meta bm)
+size_t bud_malloc_batch(size_t size, size_t count, void** out, int fill)
 {
-    bm->is_free = 1;
-    coalesce(bm);
+    struct bud_arena *a = thread_arena();
+    size_t done = 0;
+    while (done < count)
+    {
+        // the blocks are filled without the lock, 64 at a time
+        size_t n = MIN(count - done, 64UL);
+        unsigned long zeros = 0;
+        size_t i = 0;
+        pthread_mutex_lock(&a->lock);
+        drain(a);
+        for (; i < n; i++)
+        {
+            int zero;
+            bud_meta bbp = bud_alloc(a, size, BUD_BLOCK_SIZE, &zero);
+            if (bbp == NULL)
+                break;
+            zeros |= (unsigned long) zero << i;
+            out[done + i] = bbp->data;
+        }
+        pthread_mutex_unlock(&a->lock);
+
+        for (size_t j = 0; j < i; j++)
+        {
+            bud_meta bbp = (bud_meta)((char *) out[done + j] - BUD_BLOCK_SIZE);
+            fill_memory(bbp->data, fill, block_size(bbp) - BUD_BLOCK_SIZE, (zeros >> j) & 1);
+        }
+        done += i;
+        if (i < n)
+            break;
+    }
+    return done;
+}
+
+
+void* bud_aligned_alloc(size_t alignment, size_t size, int fill)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) || alignment > BUD_MAX_REQUEST)
+        return NULL;
+    // the data of every block is aligned to 16 bytes
+    if (alignment <= 16)
+        return bud_malloc(size, fill);
+
+    /* A block is aligned to its size (relative to the start of the heap,
+       which is aligned to REGION_ALIGN), so the data is put `alignment`
+       bytes after the header (which is followed by the tag). Bigger
+       alignments need some slack. */
+    size_t offset = MAX(alignment, BUD_BLOCK_SIZE + sizeof(struct bud_tag));
+    size_t head = alignment <= REGION_ALIGN ? offset : offset + alignment;
+
+    struct bud_arena *a = thread_arena();
+    pthread_mutex_lock(&a->lock);
+    drain(a);
+    int zero;
+    bud_meta bbp = bud_alloc(a, size, head, &zero);
+    void *ptr = NULL;
+    if (bbp != NULL)
+    {
+        bbp->info |= (size_t) order_of(alignment) << BUD_ALIGN_SHIFT;
+        seal(bbp);
+        ptr = data_of(bbp);
+        struct bud_tag *tag = (struct bud_tag *) ptr - 1;
+        tag->block = bbp;
+        tag->magic = tag_checksum(bbp, ptr);
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    if (ptr != NULL)
+    {
+        fill_memory(ptr, fill, usable_of(bbp, ptr), zero);
+    }
+    return ptr;
+}
+
+
+/**
+ * @brief grows the allocated block in place to `size` bytes
+ * 
+ * While the block is the left half of its parent and its buddy is a whole
+ * free block, the two are merged. If the block reaches the top of the heap,
+ * the heap is extended by the missing buddies instead (the new memory is
+ * aligned like a block of `size` bytes if the block is).
+ * 
+ * NOTE: the lock of the arena should be held. Nothing is changed on failure.
+ * 
+ * @param a the arena of the block
+ * @param bm an allocated block
+ * @param size a power of two, bigger than the block
+ * @param zero set to whether the new part of the block is zero
+ * @return int 1 if the block was grown and 0 otherwise
+ */
+static int grow_block(struct bud_arena *a, bud_meta bm, size_t size, int *zero)
+{
+    size_t offset = (size_t)((char *) bm - a->heap.base);
+    size_t heap_size = sum_allocated(a);
+    if (offset & (size - 1))
+        return 0; // it is not the start of a block of `size` bytes
+
+    size_t s = block_size(bm);
+    for (; s < size && offset + s < heap_size; s *= 2)
+    {
+        bud_meta buddy = (bud_meta)((char *) bm + s);
+        if (!block_is_free(buddy) || block_size(buddy) != s)
+            return 0;
+    }
+    // the buddies of the rest would be after the top of the heap
+    if (s < size && region_grow(&a->heap, size - s) == NULL)
+        return 0;
+
+    *zero = 1;
+    for (s = block_size(bm); s < size && offset + s < heap_size; s *= 2)
+    {
+        bud_meta buddy = (bud_meta)((char *) bm + s);
+        list_remove(a, buddy);
+        if (block_is_zero(buddy))
+        { // its header and links are in the data of bm now
+            memset(buddy, 0, BUD_BLOCK_SIZE + 2 * sizeof(bud_meta));
+        } else {
+            *zero = 0;
+        }
+    }
+    set_order(bm, order_of(size));
+    return 1;
 }
 
 
@@ -368,60 +969,140 @@ void* bud_realloc(void* ptr, size_t size, int fill)
         return bud_malloc(size, fill);
     }
 
-    bud_meta bm = get_block(ptr);
-    if (bm == NULL || bm->is_free) {
+    struct bud_arena *owner = owner_of(ptr);
+    if (owner == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&owner->lock);
+    bud_meta bm = get_block(owner, ptr);
+    if (bm == NULL || size > BUD_MAX_REQUEST) {
+        pthread_mutex_unlock(&owner->lock);
         return NULL;
     }
 
-    size_t request = next_pow2(BUD_BLOCK_SIZE + size);
+    // the data of aligned blocks is not right after the header
+    size_t request = MAX(next_pow2((char *) ptr - (char *) bm + size), 64U);
+
+    if (block_size(bm) == request) {
+        owner->counters.requested_bytes += size - block_request(bm);
+        set_request(bm, size);
+        seal(bm);
+        pthread_mutex_unlock(&owner->lock);
+        return ptr;
+    }
 
-    if (bm->size == request) {
-        return bm->ptr;
+    if (block_size(bm) > request && size > (size_t) __atomic_load_n(&min_limit, __ATOMIC_RELAXED))
+    {
+        owner->counters.in_use_bytes -= block_size(bm) - request;
+        owner->counters.requested_bytes += size - block_request(bm);
+        set_request(bm, size);
+        shrink_to_size(owner, bm, request);
+        seal(bm);
+        pthread_mutex_unlock(&owner->lock);
+        return ptr;
     }
 
-    if (bm->size > request && size > min_limit)
+    size_t old_size = block_size(bm);
+    size_t old_usable = usable_of(bm, ptr);
+    int zero;
+    if (old_size < request && in_limits(size) && grow_block(owner, bm, request, &zero))
     {
-        shrink_to_size(bm, request);
-        return bm->ptr;
+        owner->counters.in_use_bytes += request - old_size;
+        owner->counters.requested_bytes += size - block_request(bm);
+        set_request(bm, size);
+        seal(bm);
+        pthread_mutex_unlock(&owner->lock);
+        fill_memory((char *) ptr + old_usable, fill, usable_of(bm, ptr) - old_usable, zero);
+        return ptr;
     }
+    pthread_mutex_unlock(&owner->lock);
 
-    // We need a bigger space
-    void* new_mem = bud_malloc(size, fill);
-    if (new_mem == NULL)
+    // We need a bigger space, it comes from the arena of this thread
+    struct bud_arena *a = thread_arena();
+    pthread_mutex_lock(&a->lock);
+    drain(a);
+    bud_meta nb = bud_alloc(a, size, BUD_BLOCK_SIZE, &zero);
+    pthread_mutex_unlock(&a->lock);
+    if (nb == NULL)
     {
         return NULL;
     }
-    memcpy(new_mem, bm->ptr, MIN(size, bm->size));
-    free_block(bm);
-    return new_mem;
+    size_t copied = MIN(size, usable_of(bm, ptr));
+    memcpy(nb->data, ptr, copied);
+    fill_memory(nb->data + copied, fill, block_size(nb) - BUD_BLOCK_SIZE - copied, zero);
+
+    release(a, owner, bm);
+    return nb->data;
 }
 
 
 void bud_free(void* ptr)
 {
-    bud_meta block  = get_block(ptr);
+    struct bud_arena *owner = owner_of(ptr);
+    bud_meta block = get_block(owner, ptr);
+
+    // pointers to invalid or already freed blocks are ignored
     if (block != NULL)
     {
-        free_block(block);
+        release(thread_arena(), owner, block);
     }
 }
 
-void bud_show_stats(){
-    unsigned allocated = bud_show_stats_by_type(0);
-    unsigned not_allocated = bud_show_stats_by_type(1);
-    printf("total allocated: %d\ntotal free: %d\n", allocated, not_allocated);
-    void* sbrk_pointer = sbrk(0);
-    printf("sbrk pointer and allocated + free difference: %u\n", sbrk_pointer - (allocated + not_allocated));
+
+int bud_free_sized(void* ptr, size_t size)
+{
+    struct bud_arena *owner = owner_of(ptr);
+    if (owner == NULL)
+        return 0;
+
+    // the order of a block of bud_malloc follows from its size, so its header
+    // is only checked by claim. An aligned block (its header is not right
+    // before ptr) or a wrong size is looked up like bud_free.
+    bud_meta block = (bud_meta)((char *) ptr - BUD_BLOCK_SIZE);
+    if (size > BUD_MAX_REQUEST
+        || block_order(block) != order_of(MAX(next_pow2(BUD_BLOCK_SIZE + size), 64U))
+        || !release(thread_arena(), owner, block))
+    {
+        bud_free(ptr);
+    }
+    return 1;
+}
+
+
+void bud_free_batch(void** ptrs, size_t count)
+{
+    struct bud_arena *a = thread_arena();
+    pthread_mutex_lock(&a->lock);
+    for (size_t i = 0; i < count; i++)
+    {
+        struct bud_arena *owner = owner_of(ptrs[i]);
+        bud_meta block = get_block(owner, ptrs[i]);
+        if (block == NULL || !claim(block))
+            continue;
+        if (owner != a)
+        {
+            push_remote(owner, block);
+        } else {
+            free_block(a, block);
+        }
+    }
+    pthread_mutex_unlock(&a->lock);
+}
+
+
+size_t bud_usable_size(void* ptr)
+{
+    bud_meta block = get_block(owner_of(ptr), ptr);
+    return block == NULL ? 0 : usable_of(block, ptr);
 }
 
-int bud_show_stats_by_type(int is_free){
+size_t bud_show_stats_by_type(struct bud_arena *a, int is_free){
 
-    bud_meta first = head;
-    if (head == NULL){
+    if (a->heap.base == NULL){
         return 0;
     }
-    bud_meta temp = head->next;
-    unsigned total_size = 0;
+    size_t total_size = 0;
 
     if(is_free){
         printf("showing free blocks:\n");
@@ -429,40 +1110,125 @@ int bud_show_stats_by_type(int is_free){
         printf("showing allocated blocks:\n");
     }
 
-    while (1){
-        if (first == NULL){
-            break;
+    void *end = a->heap.top;
+    for (bud_meta temp = head_of(a); (void *) temp < end;
+         temp = (bud_meta)((void *) temp + block_size(temp))){
+        if (block_is_free(temp) == is_free){
+            void *data = block_is_free(temp) ? temp->data : data_of(temp);
+            printf("start_address: %p, end_address: %p, size: %10lu\n", data, (void *) temp + block_size(temp), block_size(temp));
+            total_size += block_size(temp);
         }
-        if (temp->is_free == is_free){
-            printf("start_address: %10u, end_address: %10u, size: %10u\n", temp->ptr, temp->ptr + temp->size, temp->size);
-            total_size += temp->size;
+    }
+    return total_size;
+}
+
+void bud_show_stats(){
+    pthread_once(&arenas_once, &init_arenas);
+    int count = arena_get_count();
+    for (int i = 0; i < count; i++)
+    {
+        struct bud_arena *a = &arenas[i];
+        pthread_mutex_lock(&a->lock);
+        drain(a);
+        if (count > 1)
+        {
+            printf("arena %d:\n", i);
         }
-        if (temp->next == NULL){
-            break;
+        size_t allocated = bud_show_stats_by_type(a, 0);
+        size_t not_allocated = bud_show_stats_by_type(a, 1);
+        size_t heap_size = sum_allocated(a);
+        pthread_mutex_unlock(&a->lock);
+        printf("total allocated: %lu\ntotal free: %lu\n", allocated, not_allocated);
+        printf("heap size and allocated + free difference: %ld\n", (long) (heap_size - (allocated + not_allocated)));
+    }
+}
+
+void bud_get_stats(struct my_heap_stats *stats)
+{
+    pthread_once(&arenas_once, &init_arenas);
+    int count = arena_get_count();
+    for (int i = 0; i < count; i++)
+    {
+        struct bud_arena *a = &arenas[i];
+        pthread_mutex_lock(&a->lock);
+        heap_counters_add(stats, &a->counters);
+        stats->heap_size += sum_allocated(a);
+        if (a->order_map != 0)
+        { // every block of the highest non-empty order has the same size
+            size_t largest = (1UL << (63 - __builtin_clzl(a->order_map))) - BUD_BLOCK_SIZE;
+            stats->largest_free_block = MAX(stats->largest_free_block, largest);
+        }
+        if (i == 0)
+        {
+            stats->heap_top = a->heap.top;
         }
-        temp = temp->next;
+        pthread_mutex_unlock(&a->lock);
     }
-    return total_size;
 }
 
-int bud_set_minimum(int min)
+long bud_set_release_threshold(long threshold)
+{
+    threshold = MAX(-1L, threshold);
+    __atomic_store_n(&release_threshold, threshold, __ATOMIC_RELAXED);
+    return threshold;
+}
+
+int bud_set_max_order(int order)
+{
+    order = MIN(MAX(order, BUD_MIN_MAX_ORDER), BUD_MAX_MAX_ORDER);
+    __atomic_store_n(&max_order, order, __ATOMIC_RELAXED);
+    return order;
+}
+
+void bud_fork_lock()
+{
+    pthread_once(&arenas_once, &init_arenas);
+    pthread_mutex_lock(&limits_lock);
+    for (int i = 0; i < MAX_ARENAS; i++)
+        pthread_mutex_lock(&arenas[i].lock);
+}
+
+
+void bud_fork_unlock(int child)
+{
+    for (int i = 0; i < MAX_ARENAS; i++)
+    {
+        if (child)
+            pthread_mutex_init(&arenas[i].lock, NULL);
+        else
+            pthread_mutex_unlock(&arenas[i].lock);
+    }
+    if (child)
+        pthread_mutex_init(&limits_lock, NULL);
+    else
+        pthread_mutex_unlock(&limits_lock);
+}
+
+
+long bud_set_minimum(long min)
 {
+    pthread_mutex_lock(&limits_lock);
     if (max_limit == -1 || min <= max_limit)
     {
-        min_limit = MAX(0, min);
+        __atomic_store_n(&min_limit, MAX(0L, min), __ATOMIC_RELAXED);
     }
-    return min_limit;
+    long result = min_limit;
+    pthread_mutex_unlock(&limits_lock);
+    return result;
 }
 
 
-int bud_set_maximum(int max)
+long bud_set_maximum(long max)
 {
+    pthread_mutex_lock(&limits_lock);
     if (max == -1)
     {
-        max_limit = -1;
+        __atomic_store_n(&max_limit, -1, __ATOMIC_RELAXED);
     } else if (max > min_limit)
     {
-        max_limit = MAX(1, max);
+        __atomic_store_n(&max_limit, MAX(1L, max), __ATOMIC_RELAXED);
     }
-    return max_limit;
-}
\ No newline at end of file
+    long result = max_limit;
+    pthread_mutex_unlock(&limits_lock);
+    return result;
+}
@@ -8,10 +8,13 @@
  */
 
 #include "firstfit.h"
+#include "arena.h"
+#include "region.h"
 
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h> 
+#include <pthread.h>
 
 #define MIN(a,b)             \
 ({                           \
@@ -27,34 +30,332 @@
     _a > _b ? _a : _b;       \
 })
 
+/* seed of the header checksums */
+#define FF_MAGIC 0x5f1f5712a110c8edUL
+
 /** Initial Min limit (no limit) */
 long ff_min_limit = 0;
 
 /** initial Max limit (no limit) */
 long ff_max_limit = -1;
 
-/* this struct is created to manage block pointers */
-struct b_list {
-    s_block_ptr first;
-    s_block_ptr last;
-} b_list = {NULL, NULL};
+/* serializes changes of the limits */
+static pthread_mutex_t ff_limits_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* search policy of the free lists (see ff_set_policy) */
+static int ff_policy = FF_FIRST_FIT;
+
+/* flags in the size word of a block */
+#define FF_FREE 1UL
+/* the data is zero, except the links and the footer */
+#define FF_ZERO 2UL
+/* the block before is in a free list */
+#define FF_PREV_FREE 4UL
+
+/* bits of the checksum which hold the size minus the request */
+#define FF_SLACK_MASK 0xffffUL
+
+/* flags kept in the low bits of the size word */
+#define FF_FLAGS (FF_ALIGN - 1)
+
+/* an independent heap (see arena.h) */
+struct ff_arena {
+    /* protects every block header and the rest of the arena */
+    pthread_mutex_t lock;
+    /* the memory of the blocks, they cover it from base to top */
+    struct region heap;
+    /* flags of the block which will start at the top (FF_PREV_FREE if the
+       last block is in a free list) */
+    size_t top_flags;
+    /* heads of the segregated free lists, one per size class */
+    s_block_ptr free_lists[FF_CLASSES];
+    /* bit i is set when free_lists[i] is not empty */
+    unsigned long class_map;
+    /* size of the largest block of each free list, bit i of max_stale is set
+       when the largest block of class i was taken (it is found again by
+       ff_get_stats) */
+    size_t class_max[FF_CLASSES];
+    unsigned long max_stale;
+    /* next fit starts the search of each class at its rover */
+    s_block_ptr rovers[FF_CLASSES];
+    /* blocks freed by threads of other arenas, linked by next_free */
+    s_block_ptr remote_frees;
+    /* the free bytes and blocks are counted by the free lists */
+    struct heap_counters counters;
+};
+
+static struct ff_arena ff_arenas[MAX_ARENAS];
+static pthread_once_t ff_arenas_once = PTHREAD_ONCE_INIT;
+
+static void ff_init_arenas () {
+    for (int i = 0; i < MAX_ARENAS; i++) {
+        pthread_mutex_init(&ff_arenas[i].lock, NULL);
+        region_init(&ff_arenas[i].heap, arena_region_kind(i));
+    }
+}
+
+/**
+ * @brief returns the arena of the calling thread
+ */
+static struct ff_arena* ff_thread_arena () {
+    pthread_once(&ff_arenas_once, &ff_init_arenas);
+    return &ff_arenas[arena_index()];
+}
+
+/**
+ * @brief returns the arena whose heap contains p
+ * 
+ * It can be called without holding any lock.
+ * 
+ * @return struct ff_arena* NULL if p is not in any arena
+ */
+static struct ff_arena* ff_owner (void *p) {
+    int count = arena_get_count();
+    for (int i = 0; i < count; i++) {
+        if (region_contains(&ff_arenas[i].heap, p)) {
+            return &ff_arenas[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief returns the size class of a block with `size` bytes of data
+ * 
+ * class i holds the blocks with size in [2^i, 2^(i+1)). Blocks smaller than 2
+ * bytes are all kept in class 0.
+ */
+static inline int ff_class (size_t size) {
+    return size < 2 ? 0 : 63 - __builtin_clzl(size);
+}
+
+/**
+ * @brief returns the data size of a block for a request of `size` bytes
+ */
+static inline size_t ff_round (size_t size) {
+    return size < FF_MIN_SIZE ? FF_MIN_SIZE : (size + FF_ALIGN - 1) & ~(size_t) FF_FLAGS;
+}
+
+/**
+ * @brief returns the data size of b (without the flags)
+ */
+static inline size_t ff_size (s_block_ptr b) {
+    return b->size & ~(size_t) FF_FLAGS;
+}
+
+/**
+ * @brief changes the data size of b and keeps its flags
+ */
+static inline void ff_set_size (s_block_ptr b, size_t size) {
+    b->size = size | (b->size & FF_FLAGS);
+}
+
+/**
+ * @brief sets or clears a flag of b
+ */
+static inline void ff_set_flag (s_block_ptr b, size_t flag, int on) {
+    b->size = on ? b->size | flag : b->size & ~flag;
+}
+
+static inline int ff_is_free (s_block_ptr b) {
+    return (b->size & FF_FREE) != 0;
+}
+
+static inline int ff_is_zero (s_block_ptr b) {
+    return (b->size & FF_ZERO) != 0;
+}
+
+/**
+ * @brief returns the block after b or NULL if b is the last block
+ */
+static inline s_block_ptr ff_next (struct ff_arena *a, s_block_ptr b) {
+    char *next = b->data + ff_size(b);
+    return next < a->heap.top ? (s_block_ptr) next : NULL;
+}
+
+/**
+ * @brief returns the size word of the block which starts at `start`
+ * 
+ * The top of the heap has no block yet, its flags are kept in the arena.
+ */
+static inline size_t* ff_size_word (struct ff_arena *a, char *start) {
+    return start < a->heap.top ? &((s_block_ptr) start)->size : &a->top_flags;
+}
+
+/**
+ * @brief returns the FREE block which ends at `end` using its footer
+ * 
+ * @return s_block_ptr NULL if the block before `end` is not in a free list
+ */
+static inline s_block_ptr ff_prev_free (struct ff_arena *a, char *end) {
+    if (end == NULL || !(*ff_size_word (a, end) & FF_PREV_FREE)) {
+        return NULL;
+    }
+    size_t size = ((size_t *) end)[-1];
+    return (s_block_ptr) (end - size - BLOCK_SIZE);
+}
+
+/**
+ * @brief returns the checksum of the header of b (without the slack bits)
+ */
+static inline uintptr_t ff_checksum (s_block_ptr b) {
+    return (FF_MAGIC ^ (uintptr_t) b ^ ff_size(b)) & ~FF_SLACK_MASK;
+}
+
+/**
+ * @brief updates the checksum of b and keeps `request` in it
+ * 
+ * It should be called whenever a block is allocated or the size of an
+ * allocated block or its request changes.
+ */
+static inline void ff_seal (s_block_ptr b, size_t request) {
+    b->magic = ff_checksum(b) | (ff_size(b) - request);
+}
+
+/**
+ * @brief returns the size requested for the allocated block b
+ * 
+ * It can also be called after b is claimed (see ff_claim).
+ */
+static inline size_t ff_request (s_block_ptr b) {
+    return ff_size(b) - (b->magic & FF_SLACK_MASK);
+}
+
+/**
+ * @brief returns whether the free list of the policy keeps b before next
+ */
+static inline int ff_list_before (s_block_ptr b, s_block_ptr next) {
+    switch (ff_policy) {
+    case FF_BEST_FIT:
+        return ff_size(b) <= ff_size(next);
+    case FF_ADDRESS_FIT:
+        return b < next;
+    default:
+        return 1;
+    }
+}
+
+/**
+ * @brief inserts the FREE block b into its size class free list
+ * 
+ * It is pushed to the head, unless the list of the policy is sorted. The
+ * footer of b is written and the block after it is told that b is free.
+ * 
+ * @param b a FREE block which is not in any free list
+ */
+void ff_list_insert (struct ff_arena *a, s_block_ptr b) {
+    size_t size = ff_size(b);
+    int c = ff_class(size);
+    s_block_ptr prev = NULL;
+    s_block_ptr next = a->free_lists[c];
+    while (next != NULL && !ff_list_before (b, next)) {
+        prev = next;
+        next = next->next_free;
+    }
+    b->prev_free = prev;
+    b->next_free = next;
+    if (next != NULL) {
+        next->prev_free = b;
+    }
+    if (prev != NULL) {
+        prev->next_free = b;
+    } else {
+        a->free_lists[c] = b;
+    }
+    a->class_map |= 1UL << c;
+    if (size > a->class_max[c]) {
+        a->class_max[c] = size;
+    }
+    ((size_t *) (b->data + size))[-1] = size;
+    *ff_size_word (a, b->data + size) |= FF_PREV_FREE;
+    a->counters.free_bytes += size;
+    a->counters.free_blocks++;
+}
+
+/**
+ * @brief unlinks b from the free list of its size class
+ * 
+ * NOTE: the size of b should not be changed since its insertion, otherwise
+ * the wrong list will be updated.
+ * 
+ * @param b a FREE block which is in a free list
+ */
+void ff_list_remove (struct ff_arena *a, s_block_ptr b) {
+    size_t size = ff_size(b);
+    int c = ff_class(size);
+    if (a->rovers[c] == b) {
+        a->rovers[c] = b->next_free;
+    }
+    if (b->prev_free != NULL) {
+        b->prev_free->next_free = b->next_free;
+    } else {
+        a->free_lists[c] = b->next_free;
+    }
+    if (b->next_free != NULL) {
+        b->next_free->prev_free = b->prev_free;
+    }
+    if (a->free_lists[c] == NULL) {
+        a->class_map &= ~(1UL << c);
+        a->class_max[c] = 0;
+        a->max_stale &= ~(1UL << c);
+    } else if (size == a->class_max[c]) {
+        a->max_stale |= 1UL << c;
+    }
+    b->next_free = b->prev_free = NULL;
+    *ff_size_word (a, b->data + size) &= ~FF_PREV_FREE;
+    a->counters.free_bytes -= size;
+    a->counters.free_blocks--;
+}
+
+/**
+ * @brief takes the ownership of the allocated block b for freeing it
+ * 
+ * The checksum of b is cleared atomically (only the slack is kept), so of many
+ * concurrent frees of the same block exactly one succeeds and the others see
+ * an invalid block.
+ * 
+ * @return int 1 if the caller should free b and 0 otherwise
+ */
+static inline int ff_claim (s_block_ptr b) {
+    uintptr_t sum = __atomic_load_n(&b->magic, __ATOMIC_RELAXED);
+    if ((sum & ~FF_SLACK_MASK) != ff_checksum(b)) {
+        return 0;
+    }
+    return __atomic_compare_exchange_n(&b->magic, &sum, sum & FF_SLACK_MASK, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief pushes the claimed block b to the remote free queue of its arena
+ * 
+ * It is lock-free, the block will be freed by the next allocation of the
+ * arena (see ff_drain).
+ */
+static void ff_push_remote (struct ff_arena *a, s_block_ptr b) {
+    s_block_ptr head = __atomic_load_n(&a->remote_frees, __ATOMIC_RELAXED);
+    do {
+        b->next_free = head;
+    } while (!__atomic_compare_exchange_n(&a->remote_frees, &head, b, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
 
 /**
  * @brief moves header of the b to the new_start and add diff to its size
  * 
+ * The block will be reinserted in the free list of its new size class.
+ * 
  * @param b block to be moved. It should be FREE. 
- * @param new_start new location of the block.
+ * @param new_start new location of the block, the block before it is
+ *                  allocated.
  */
-void move_is_free_block_back (s_block_ptr b, void *new_start) {
-    size_t diff = (void *) b - new_start;
-    memmove(new_start, b, BLOCK_SIZE);
+void move_is_free_block_back (struct ff_arena *a, s_block_ptr b, void *new_start) {
+    size_t size = ff_size(b) + ((char *) b - (char *) new_start);
+    ff_list_remove (a, b);
     b = (s_block_ptr) new_start;
-    b->prev->next = b;
-    b->size = b->size + diff;
-    if (b->next != NULL) {
-        b->next->prev = b;
-    }
-    b->ptr = &b->data;
+    /* the old header and the end of the block before are in the data now */
+    b->size = size | FF_FREE;
+    b->magic = 0;
+    ff_list_insert (a, b);
 }
 
 /**
@@ -69,43 +370,40 @@ void move_is_free_block_back (s_block_ptr b, void *new_start) {
  *      moved to the is_free part and the size will be added to the current size
  *      of the next block.
  *
- *      2. size of the remaining part is bigger than the SIZE_BLOCK and
- *      metadata part can fit into it, so a new is_free part will be created and
- *      prev and next of the three blocks will be updated.
- * 
- *      3.1. remaining is less than BLOCK_SIZE but it is at the end of the 
- *      allocated memories so we will set break to the end of the segment that
- *      is needed and if the rest is needed will be allocated later.
+ *      3.1. this block is at the end of the allocated memories so we will
+ *      set the top of the heap to the end of the segment that is needed and if
+ *      the rest is needed will be allocated later (if the heap cannot be
+ *      shrunk, the other scenarios are checked).
+ *
+ *      2. size of the remaining part can hold a header and FF_MIN_SIZE bytes,
+ *      so a new is_free part will be created after this block.
  *
  *      3.2. size of the remaining part is not enough to create a new block so
  *      we assume that part is no man land and we won't tell user that!
  * 
- * @param b the block that will be splitted - should be a valid block
- * @param s size of the block AFTER reduction
+ * @param a the arena of the block
+ * @param b the block that will be splitted - should be a valid block which is
+ *          not in any free list
+ * @param s size of the block AFTER reduction (a multiple of FF_ALIGN)
  */
-void split_block (s_block_ptr b, size_t s) {
-    if (b->size <= s) 
+void split_block (struct ff_arena *a, s_block_ptr b, size_t s) {
+    size_t size = ff_size(b);
+    if (size <= s) 
         return;
     
-    void *end_of_b = b->ptr + s;
-    if (b->next != NULL && b->next->is_free) {
-        move_is_free_block_back (b->next, end_of_b);
-        b->size = s;
-    } else if (b->next == NULL) {
-        brk(end_of_b);
-        b->size = s;
-    } else if (b->size - s >= BLOCK_SIZE) {
+    char *end_of_b = b->data + s;
+    s_block_ptr next = ff_next (a, b);
+    if (next != NULL && ff_is_free(next)) {
+        move_is_free_block_back (a, next, end_of_b);
+        ff_set_size (b, s);
+    } else if (next == NULL && region_trim(&a->heap, end_of_b) == 0) {
+        ff_set_size (b, s);
+    } else if (size - s >= BLOCK_SIZE + FF_MIN_SIZE) {
         s_block_ptr new_block = (s_block_ptr) end_of_b;
-        s_block_ptr next = b->next;
-        b->next = new_block;
-        new_block->prev = b;
-        new_block->next = next;
-        next->prev = new_block;
-        new_block->size = b->size - s - BLOCK_SIZE;
-        new_block->ptr = &new_block->data;
-        new_block->is_free = 1;
-        b->size = s;
-        b_list.last = new_block;
+        new_block->size = (size - s - BLOCK_SIZE) | FF_FREE | (b->size & FF_ZERO);
+        new_block->magic = 0;
+        ff_set_size (b, s);
+        ff_list_insert (a, new_block);
     }
 }
 
@@ -114,20 +412,26 @@ void split_block (s_block_ptr b, size_t s) {
  * @brief fuse two prior and late blocks
  * 
  * It will remove metadata of the late block and update metadata of the prior
- * block. Both prior and late must be FREE and valid blocks. 
+ * block. Both prior and late must be FREE and valid blocks and neither of
+ * them should be in a free list.
  * 
  * @param prior the block that will expanded
- * @param late  the block which will be fused to the other, it must be after
- *              the prior block
+ * @param late  the block which will be fused to the other, it must be right
+ *              after the prior block
  */
-void ff_fuse (s_block_ptr prior, s_block_ptr late) {
-    prior->next = late->next;
-    if (late->next != NULL) {
-        late->next->prev = prior;
+void ff_fuse (struct ff_arena *a, s_block_ptr prior, s_block_ptr late) {
+    (void) a;
+    size_t size = ff_size(prior);
+    late->magic = 0;
+    if (ff_is_zero(prior) && ff_is_zero(late)) {
+        /* the footer of prior, the header of late and its links are the only
+           parts of the data which are not zero */
+        memset(prior->data + size - sizeof(size_t), 0,
+               sizeof(size_t) + BLOCK_SIZE + 2 * sizeof(s_block_ptr));
     } else {
-        b_list.last = prior;
+        ff_set_flag (prior, FF_ZERO, 0);
     }
-    prior->size = prior->size + late->size + BLOCK_SIZE;
+    ff_set_size (prior, size + BLOCK_SIZE + ff_size(late));
 }
 
 
@@ -137,57 +441,71 @@ void ff_fuse (s_block_ptr prior, s_block_ptr late) {
  * it will fuse is_free adjacent blocks together. It only checks prev and next
  * blocks because if it be used after each ff_is_free then there only can't be
  * other sequence of is_free blocks (they where fused together when one of them
- * was is_freed)!
+ * was is_freed)! Both are found in constant time: the next block right after
+ * the data of b and the previous one by its footer (boundary tags).
+ * 
+ * The fused block will be inserted in the free list of its size class.
  * 
- * @param b the block to perform possible fusions on
+ * @param a the arena of the block
+ * @param b the block to perform possible fusions on (not in any free list)
  * @return pointer to the new b (the block that b was fused to) 
  */
-s_block_ptr fusion (s_block_ptr b) {
-    if (!b->is_free) {
+s_block_ptr fusion (struct ff_arena *a, s_block_ptr b) {
+    if (!ff_is_free(b)) {
         return b;
     }
 
-    if (b->prev != NULL && b->prev->is_free) {
-        s_block_ptr prev = b->prev;
-        ff_fuse (prev, b);
+    s_block_ptr prev = ff_prev_free (a, (char *) b);
+    if (prev != NULL) {
+        ff_list_remove (a, prev);
+        ff_fuse (a, prev, b);
         b = prev;
     }
 
-    if (b->next != NULL && b->next->is_free) {
-        ff_fuse (b, b->next);
-    }
-
-    if (b->next == NULL) {
-        b_list.last = b;
+    s_block_ptr next = ff_next (a, b);
+    if (next != NULL && ff_is_free(next)) {
+        ff_list_remove (a, next);
+        ff_fuse (a, b, next);
     }
 
+    ff_list_insert (a, b);
     return b;
 }
 
 /**
  * @brief Get the block object corresponding to ptr
  * 
- * For sanity this function will iterate over all allocated blocks and retrive
- * the ptr of that. because ptr may be invalid and looking for BLOCK_SIZE bytes
- * ahead may cause conflicts and security issues.
+ * For sanity ptr is not trusted: it should be inside the heap and the header
+ * BLOCK_SIZE bytes behind it should have a valid checksum and point back to
+ * ptr. As ptr is checked to be in the heap, reading that header cannot cause
+ * a fault, so this is done in constant time without walking the blocks.
  * 
+ * The header of an allocated block is only changed by its owner, so this can
+ * be called without holding the lock of the arena (but the block may be
+ * freed concurrently if the caller does not own it).
+ * 
+ * @param a the arena of the block (it can be NULL)
  * @param p start of allocated memory
- * @return s_block_ptr 
+ * @return s_block_ptr NULL if p is not the start of an allocated block
  */
-s_block_ptr ff_get_block (void *p) {
-    if (p == NULL) {
+s_block_ptr ff_get_block (struct ff_arena *a, void *p) {
+    if (p == NULL || a == NULL || !region_contains(&a->heap, p)) {
         return NULL;
     }
 
-    s_block_ptr sb = b_list.first;
-    while (sb) {
-        if (sb->ptr == p) {
-            return sb;
-        }
-        sb = sb->next;
+    void *start = __atomic_load_n(&a->heap.base, __ATOMIC_ACQUIRE);
+    void *end = __atomic_load_n(&a->heap.top, __ATOMIC_ACQUIRE);
+    if (p < start + BLOCK_SIZE) {
+        return NULL;
     }
 
-    return NULL;
+    s_block_ptr sb = (s_block_ptr) (p - BLOCK_SIZE);
+    if ((sb->magic & ~FF_SLACK_MASK) != ff_checksum(sb) || ff_is_free(sb)
+        || ff_size(sb) > (size_t) (end - p)) {
+        return NULL;
+    }
+
+    return sb;
 }
 
 /**
@@ -199,93 +517,464 @@ s_block_ptr ff_get_block (void *p) {
  * If there wasn't a is_free block at the last a new block will be constructed. at
  * any time that allocation can't be done it will return NULL.
  * 
- * @param last the last element of the block lists.
+ * The returned block is FREE but it is not in any free list.
+ * 
+ * @param a the arena whose heap is extended
  * @param s size to be allocated
  * @return NULL on failure and a pointer to the newly allocated(expanded) block
  */
-s_block_ptr ff_extend_heap (s_block_ptr last , size_t s) {
-    void *mem;
+s_block_ptr ff_extend_heap (struct ff_arena *a, size_t s) {
+    s_block_ptr last = ff_prev_free (a, a->heap.top);
 
-    if (last != NULL && last->is_free) {
-        mem = sbrk(s - last->size);
-        if (mem == (void *) -1) {
+    if (last != NULL) {
+        size_t size = ff_size(last);
+        ff_list_remove (a, last);
+        if (region_grow(&a->heap, s - size) == NULL) {
+            ff_list_insert (a, last);
             return NULL;
         }
 
-        last->size = s;
+        if (ff_is_zero(last)) {
+            /* the old footer is in the middle of the data now */
+            memset(last->data + size - sizeof(size_t), 0, sizeof(size_t));
+        }
+        ff_set_size (last, s);
         return last;
     }
     
-    mem = sbrk(BLOCK_SIZE + s);
-    if (mem == (void *) -1) {
+    if (s > SIZE_MAX - BLOCK_SIZE) {
         return NULL;
     }
-
-    s_block_ptr header = (s_block_ptr) mem;
-    header->ptr = &header->data;
-    header->is_free = 1;
-    header->next = NULL;
-    header->prev = last;
-    header->size = s;
-    if (last == NULL) {
-        b_list.first = header;
-    } else {
-        last->next = header;
+    s_block_ptr header = (s_block_ptr) region_grow(&a->heap, BLOCK_SIZE + s);
+    if (header == NULL) {
+        return NULL;
     }
-    b_list.last = header;
+
+    /* memory after the top of the region is zero (see region.h), the last
+       block is not free so there is no FF_PREV_FREE */
+    header->size = s | FF_FREE | FF_ZERO;
+    header->magic = 0;
     return header;
 }
 
 
+/**
+ * @brief returns the first block of the list from `from` (up to `to`) which
+ *        has at least `size` bytes
+ */
+static inline s_block_ptr ff_scan (s_block_ptr from, s_block_ptr to, size_t size) {
+    for (s_block_ptr sb = from; sb != to; sb = sb->next_free) {
+        if (ff_size(sb) >= size) {
+            return sb;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief next fit: searches from the rover of the class and wraps around
+ * 
+ * The rover moves after the found block.
+ */
+static s_block_ptr ff_next_fit (struct ff_arena *a, int c, size_t size) {
+    s_block_ptr rover = a->rovers[c];
+    s_block_ptr sb = ff_scan (rover != NULL ? rover : a->free_lists[c], NULL, size);
+    if (sb == NULL && rover != NULL) {
+        sb = ff_scan (a->free_lists[c], rover, size);
+    }
+    if (sb != NULL) {
+        a->rovers[c] = sb->next_free;
+    }
+    return sb;
+}
+
+/**
+ * @brief finds a free block of at least `size` bytes in the free lists
+ * 
+ * Only the free list of the size class of `size` can hold blocks that are too
+ * small, so it is searched with the policy (see ff_set_policy). Every block
+ * of the bigger classes fits, so one of the first non-empty one is taken:
+ * the head (the smallest for best fit, the last freed for first fit) or the
+ * one at the rover for next fit. Address ordered first fit compares the
+ * heads of all the bigger classes, as each is the lowest of its class.
+ * 
+ * @param a the arena to search in
+ * @param size 
+ * @return s_block_ptr NULL if there is no such free block
+ */
+s_block_ptr ff_find_free (struct ff_arena *a, size_t size) {
+    int c = ff_class(size);
+    s_block_ptr sb = ff_policy == FF_NEXT_FIT ? ff_next_fit (a, c, size)
+                                              : ff_scan (a->free_lists[c], NULL, size);
+    unsigned long bigger = c + 1 < FF_CLASSES ? a->class_map >> (c + 1) : 0;
+
+    if (ff_policy == FF_ADDRESS_FIT) {
+        for (; bigger != 0; bigger &= bigger - 1) {
+            s_block_ptr head = a->free_lists[c + 1 + __builtin_ctzl(bigger)];
+            if (sb == NULL || head < sb) {
+                sb = head;
+            }
+        }
+        return sb;
+    }
+
+    if (sb != NULL || bigger == 0) {
+        return sb;
+    }
+    c += 1 + __builtin_ctzl(bigger);
+    return ff_policy == FF_NEXT_FIT ? ff_next_fit (a, c, 0) : a->free_lists[c];
+}
+
 /**
  * @brief finds a block with first fit or allocate a new one
  * 
- * iterate over allocated blocks to find first-fit block 
+ * search the segregated free lists for a fitting block 
  * - first block that was found will be splitted for the new data
  * - if none was found heap will be extended
  * 
- * @param size 
+ * The returned block is FREE but it is not in any free list anymore.
+ * 
+ * @param a the arena to allocate from
+ * @param size a multiple of FF_ALIGN (see ff_round)
  * @return s_block_ptr 
  */
-s_block_ptr get_first_fit (size_t size) {
-    s_block_ptr sb = b_list.first;
-    while (sb) {
-        if (sb->is_free && sb->size >= size) {
-            /* memory should be splitted */
-            if (sb->size > size) {
-                split_block(sb, size);
-            }
-            return sb;
+s_block_ptr get_first_fit (struct ff_arena *a, size_t size) {
+    s_block_ptr sb = ff_find_free (a, size);
+    if (sb != NULL) {
+        ff_list_remove (a, sb);
+        /* memory should be splitted */
+        if (ff_size(sb) > size) {
+            split_block(a, sb, size);
         }
-        sb = sb->next;
+        return sb;
     }
 
     /* if reached here no enough space was found  we should extend the heap */
-    sb = ff_extend_heap (b_list.last, size);
+    sb = ff_extend_heap (a, size);
 
     return sb;
 }
 
+/**
+ * @brief marks the block allocated for a request of `request` bytes
+ * 
+ * @param zero set to whether the data of the block is zero
+ */
+static void ff_mark_allocated (struct ff_arena *a, s_block_ptr sb, size_t request, int *zero)
+{
+    *zero = ff_is_zero(sb);
+    if (*zero) {
+        /* the links and the footer of the free block were not zero */
+        memset(sb->data, 0, 2 * sizeof(s_block_ptr));
+        memset(sb->data + ff_size(sb) - sizeof(size_t), 0, sizeof(size_t));
+    }
+    sb->size &= ~(FF_FREE | FF_ZERO);
+    ff_seal (sb, request);
+    a->counters.in_use_bytes += ff_size(sb);
+    a->counters.requested_bytes += request;
+    a->counters.in_use_blocks++;
+}
+
+/**
+ * @brief marks the allocated (and claimed) block FREE
+ * 
+ * The block is not in any free list yet (see fusion).
+ */
+static void ff_mark_free (struct ff_arena *a, s_block_ptr sb)
+{
+    a->counters.in_use_bytes -= ff_size(sb);
+    a->counters.requested_bytes -= ff_request(sb);
+    a->counters.in_use_blocks--;
+    sb->size = (sb->size & ~FF_ZERO) | FF_FREE;
+}
+
+/**
+ * @brief frees the blocks of the remote free queue of the arena
+ * 
+ * The whole queue is detached with one exchange, so the remote frees are
+ * handled in a batch under a single acquisition of the lock.
+ * 
+ * NOTE: the lock of the arena should be held.
+ */
+static void ff_drain (struct ff_arena *a) {
+    if (__atomic_load_n(&a->remote_frees, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+
+    s_block_ptr b = __atomic_exchange_n(&a->remote_frees, NULL, __ATOMIC_ACQUIRE);
+    while (b != NULL) {
+        s_block_ptr next = b->next_free;
+        b->next_free = NULL;
+        ff_mark_free (a, b);
+        fusion(a, b);
+        b = next;
+    }
+}
+
+/**
+ * @brief checks the min and max limits
+ * 
+ * @return int 1 if a request of `size` bytes is acceptable
+ */
+static int ff_in_limits (size_t size)
+{
+    long min_limit = __atomic_load_n(&ff_min_limit, __ATOMIC_RELAXED);
+    long max_limit = __atomic_load_n(&ff_max_limit, __ATOMIC_RELAXED);
+
+    /* the size should not be zero and should match the min and max constraints */
+    /* the minimum is never negative and the maximum is -1 or positive */
+    return size > 0 && size >= (size_t) min_limit && (max_limit == -1 || size <= (size_t) max_limit)
+        && size <= SIZE_MAX - FF_ALIGN;
+}
+
+/**
+ * @brief finds a block for `size` bytes and marks it allocated
+ * 
+ * NOTE: the lock of the arena should be held.
+ * 
+ * @param zero set to whether the data of the block is zero
+ * @return s_block_ptr NULL if size is not acceptable or on failure
+ */
+static s_block_ptr ff_alloc (struct ff_arena *a, size_t size, int *zero)
+{
+    if (!ff_in_limits (size)) {
+        return NULL;
+    }
+
+    s_block_ptr sb = get_first_fit (a, ff_round (size));
+    if (sb != NULL) {
+        ff_mark_allocated (a, sb, size, zero);
+    }
+    return sb;
+}
+
+/**
+ * @brief moves the start of the data of b forward to a multiple of alignment
+ * 
+ * The padding in front of the new data can hold a header and FF_MIN_SIZE
+ * bytes, so it becomes a FREE block (fused with the block before it if
+ * possible) and the header is moved right before the new data.
+ * 
+ * NOTE: the size of b should be big enough for the padding.
+ * 
+ * @param a the arena of the block
+ * @param b a block which is not in any free list
+ * @param alignment a power of two
+ * @return s_block_ptr the block with the aligned data, it is ALLOCATED but
+ *         not sealed
+ */
+static s_block_ptr ff_align_block (struct ff_arena *a, s_block_ptr b, size_t alignment)
+{
+    ff_set_flag (b, FF_FREE, 0);
+    uintptr_t data = (uintptr_t) b->data;
+    if (data % alignment == 0) {
+        return b;
+    }
+
+    uintptr_t target = (data + BLOCK_SIZE + FF_MIN_SIZE + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    size_t padding = target - data;
+    s_block_ptr nb = (s_block_ptr) (target - BLOCK_SIZE);
+    nb->size = (ff_size(b) - padding) | (b->size & FF_ZERO);
+    nb->magic = 0;
+
+    /* the padding is given back */
+    ff_set_size (b, padding - BLOCK_SIZE);
+    ff_set_flag (b, FF_FREE, 1);
+    fusion(a, b);
+    return nb;
+}
+
+/**
+ * @brief frees the allocated block sb of the arena owner
+ * 
+ * If the owner is the arena of the calling thread (a), the block is freed
+ * right away. Otherwise the lock of the owner is not taken, the block is
+ * pushed to its remote free queue instead.
+ */
+static void ff_release (struct ff_arena *a, struct ff_arena *owner, s_block_ptr sb)
+{
+    if (!ff_claim (sb)) {
+        return;
+    }
+
+    if (owner != a) {
+        ff_push_remote (owner, sb);
+        return;
+    }
+
+    pthread_mutex_lock(&owner->lock);
+    /* it should set FREE state to 1 and fuse if available */
+    ff_mark_free (owner, sb);
+    fusion(owner, sb);
+    pthread_mutex_unlock(&owner->lock);
+}
+
 void* ff_malloc(size_t size, int fill)
 {  
-    /* returns NULL if the size is zero or the size does not match the min and max constraints */
-    if (size < ff_min_limit || (ff_max_limit != -1 && size > ff_max_limit))
-    {
+    struct ff_arena *a = ff_thread_arena();
+    pthread_mutex_lock(&a->lock);
+    ff_drain (a);
+    int zero;
+    s_block_ptr sb = ff_alloc (a, size, &zero);
+    pthread_mutex_unlock(&a->lock);
+
+    if (sb == NULL) {
         return NULL;
+    } else {
+        /* the block is ours now, it can be filled without the lock */
+        fill_memory(sb->data, fill, size, zero);
+        return sb->data;
+    }
+}
+
+
+/**
+ * @brief carves `count` allocated blocks out of the free block sb
+ * 
+ * Every block gets `rounded` bytes of data, except the last one which gets
+ * the rest of sb. The headers of the blocks after the first are in the data
+ * of sb, so they are zero if sb is zero and every block is zero then.
+ * 
+ * @param sb a FREE block which is not in any free list, it should have at
+ *           least count * (rounded + BLOCK_SIZE) - BLOCK_SIZE bytes
+ * @param size the request of each block
+ */
+static void ff_carve (struct ff_arena *a, s_block_ptr sb, size_t rounded, size_t size,
+                      size_t count, void **out)
+{
+    char *end = sb->data + ff_size(sb);
+    size_t flags = sb->size & (FF_FREE | FF_ZERO);
+    size_t prev_free = sb->size & FF_PREV_FREE;
+    for (size_t i = 0; i < count; i++) {
+        s_block_ptr b = (s_block_ptr) ((char *) sb + i * (rounded + BLOCK_SIZE));
+        size_t s = i + 1 < count ? rounded : (size_t) (end - b->data);
+        b->size = s | flags | (i == 0 ? prev_free : 0);
+        int zero;
+        ff_mark_allocated (a, b, size, &zero);
+        out[i] = b->data;
+    }
+}
+
+
+size_t ff_malloc_batch(size_t size, size_t count, void** out, int fill)
+{
+    if (count == 0 || !ff_in_limits (size)) {
+        return 0;
+    }
+    size_t rounded = ff_round (size);
+    size_t carved = 0;
+    int zero = 0;
+
+    if (count <= (SIZE_MAX - FF_ALIGN) / (rounded + BLOCK_SIZE)) {
+        struct ff_arena *a = ff_thread_arena();
+        pthread_mutex_lock(&a->lock);
+        ff_drain (a);
+        s_block_ptr sb = get_first_fit (a, count * (rounded + BLOCK_SIZE) - BLOCK_SIZE);
+        if (sb != NULL) {
+            zero = ff_is_zero(sb);
+            ff_carve (a, sb, rounded, size, count, out);
+            carved = count;
+        }
+        pthread_mutex_unlock(&a->lock);
+    }
+
+    /* the blocks are ours now, they can be filled without the lock */
+    for (size_t i = 0; i < carved; i++) {
+        fill_memory(out[i], fill, size, zero);
     }
+    for (; carved < count; carved++) {
+        if ((out[carved] = ff_malloc (size, fill)) == NULL) {
+            break;
+        }
+    }
+    return carved;
+}
+
 
-    if (size <= 0) {
+void* ff_aligned_alloc(size_t alignment, size_t size, int fill)
+{
+    if (alignment == 0 || (alignment & (alignment - 1))
+        || size > SIZE_MAX - alignment - 2 * BLOCK_SIZE - FF_MIN_SIZE) {
         return NULL;
     }
 
-    s_block_ptr sb = get_first_fit (size);
+    struct ff_arena *a = ff_thread_arena();
+    pthread_mutex_lock(&a->lock);
+    ff_drain (a);
+    s_block_ptr sb = NULL;
+    int zero;
+    if (ff_in_limits (size)) {
+        /* a block with room for the worst padding */
+        size_t padding = alignment > FF_ALIGN ? BLOCK_SIZE + FF_MIN_SIZE + alignment - 1 : 0;
+        sb = get_first_fit (a, ff_round (size + padding));
+    }
+    if (sb != NULL) {
+        sb = ff_align_block (a, sb, alignment);
+        split_block (a, sb, ff_round (size));
+        ff_mark_allocated (a, sb, size, &zero);
+    }
+    pthread_mutex_unlock(&a->lock);
+
     if (sb == NULL) {
         return NULL;
-    } else {
-        sb->is_free = 0;
-        memset(sb->ptr, fill, size);
-        return sb->ptr;
     }
+    fill_memory(sb->data, fill, size, zero);
+    return sb->data;
+}
+
+
+/**
+ * @brief grows the allocated block b in place to `size` bytes of data
+ * 
+ * The FREE block right after b is taken (the part which is not needed is
+ * split again). If b or that FREE block is the last block, the heap is
+ * extended for the missing bytes.
+ * 
+ * NOTE: the lock of the arena should be held. Nothing is changed on failure.
+ * 
+ * @param a the arena of the block
+ * @param b an allocated block
+ * @param size a multiple of FF_ALIGN, bigger than the size of b
+ * @param zero set to whether the new part of the data is zero
+ * @return int 1 if b was grown and 0 otherwise
+ */
+static int ff_grow_block (struct ff_arena *a, s_block_ptr b, size_t size, int *zero) {
+    size_t old_size = ff_size(b);
+    s_block_ptr next = ff_next (a, b);
+    if (next == NULL) {
+        if (region_grow(&a->heap, size - old_size) == NULL) {
+            return 0;
+        }
+        /* memory after the top of the region is zero (see region.h) */
+        ff_set_size (b, size);
+        *zero = 1;
+        return 1;
+    }
+
+    if (!ff_is_free(next)) {
+        return 0;
+    }
+    size_t next_size = ff_size(next);
+    size_t available = old_size + BLOCK_SIZE + next_size;
+    size_t missing = available < size ? size - available : 0;
+    if (missing != 0 && ff_next (a, next) != NULL) {
+        return 0;
+    }
+
+    ff_list_remove (a, next);
+    if (missing != 0 && region_grow(&a->heap, missing) == NULL) {
+        ff_list_insert (a, next);
+        return 0;
+    }
+    *zero = ff_is_zero(next);
+    if (*zero) {
+        /* the footer, the header and the links are in the data of b now */
+        memset(next->data + next_size - sizeof(size_t), 0, sizeof(size_t));
+        memset(next, 0, BLOCK_SIZE + 2 * sizeof(s_block_ptr));
+    }
+    ff_set_size (b, available + missing);
+    split_block (a, b, size);
+    return 1;
 }
 
 
@@ -300,79 +989,168 @@ void* ff_realloc(void* ptr, size_t size, int fill)
         return ff_malloc(size, fill);
     }
 
-    s_block_ptr sb = ff_get_block (ptr);
-    if (sb == NULL || sb->is_free) {
+    struct ff_arena *owner = ff_owner (ptr);
+    if (owner == NULL) {
         return NULL;
     }
 
-    if (sb->size == size) 
+    pthread_mutex_lock(&owner->lock);
+    s_block_ptr sb = ff_get_block (owner, ptr);
+    if (sb == NULL) {
+        pthread_mutex_unlock(&owner->lock);
+        return NULL;
+    }
+
+    size_t old_size = ff_size(sb);
+    if (old_size == ff_round (size)) 
     {
-        return sb->ptr;
+        owner->counters.requested_bytes += size - ff_request(sb);
+        ff_seal (sb, size);
+        pthread_mutex_unlock(&owner->lock);
+        return sb->data;
     }
 
-    if (sb->size > size && size >= ff_min_limit)
+    if (old_size > size && size >= (size_t) __atomic_load_n(&ff_min_limit, __ATOMIC_RELAXED))
     {
-        split_block(sb, size);
-        return sb->ptr;
+        size_t request = ff_request(sb);
+        split_block(owner, sb, ff_round (size));
+        ff_seal (sb, size);
+        owner->counters.in_use_bytes -= old_size - ff_size(sb);
+        owner->counters.requested_bytes += size - request;
+        pthread_mutex_unlock(&owner->lock);
+        return sb->data;
     }
-    
 
-    void *new_mem = ff_malloc(size, fill);
-    if (new_mem == NULL) {
+    /* the request is in the checksum, it is read before the size changes */
+    size_t request = ff_request(sb);
+    int zero;
+    if (old_size < size && ff_in_limits (size)
+        && ff_grow_block (owner, sb, ff_round (size), &zero))
+    {
+        ff_seal (sb, size);
+        owner->counters.in_use_bytes += ff_size(sb) - old_size;
+        owner->counters.requested_bytes += size - request;
+        pthread_mutex_unlock(&owner->lock);
+        fill_memory(sb->data + old_size, fill, size - old_size, zero);
+        return sb->data;
+    }
+    pthread_mutex_unlock(&owner->lock);
+
+    /* the new block comes from the arena of this thread */
+    struct ff_arena *a = ff_thread_arena();
+    pthread_mutex_lock(&a->lock);
+    ff_drain (a);
+    s_block_ptr nb = ff_alloc (a, size, &zero);
+    pthread_mutex_unlock(&a->lock);
+    if (nb == NULL) {
         return NULL;
     }
 
-    memcpy(new_mem, sb->ptr, MIN(size, sb->size));
-    /* freeing sb */
-    sb->is_free = 1;
-    fusion(sb);
-    return new_mem;
+    size_t copied = MIN(size, old_size);
+    memcpy(nb->data, sb->data, copied);
+    fill_memory(nb->data + copied, fill, size - copied, zero);
+
+    ff_release (a, owner, sb);
+    return nb->data;
 }
 
 
 void ff_free(void* ptr)
 {
-    s_block_ptr sb = ff_get_block (ptr);
+    struct ff_arena *owner = ff_owner (ptr);
+    s_block_ptr sb = ff_get_block (owner, ptr);
 
-    if (sb == NULL) {
-        /* if the pointer in not to a valid block */
-        return;
-    } else {
-        /* else it should set FREE state to 1 and fuse if available */
-        sb->is_free = 1;
-        fusion(sb);
+    /* pointers to invalid or already freed blocks are ignored */
+    if (sb != NULL) {
+        ff_release (ff_thread_arena(), owner, sb);
+    }
+}
+
+
+int ff_free_sized(void* ptr, size_t size)
+{
+    (void) size;
+    struct ff_arena *owner = ff_owner (ptr);
+    if (owner == NULL) {
+        return 0;
+    }
+    /* the header is right before the data (even for aligned blocks), it is
+       only checked by ff_claim */
+    ff_release (ff_thread_arena(), owner, (s_block_ptr) ((char *) ptr - BLOCK_SIZE));
+    return 1;
+}
+
+
+void ff_free_batch(void** ptrs, size_t count)
+{
+    struct ff_arena *a = ff_thread_arena();
+    pthread_mutex_lock(&a->lock);
+    for (size_t i = 0; i < count; i++) {
+        struct ff_arena *owner = ff_owner (ptrs[i]);
+        s_block_ptr sb = ff_get_block (owner, ptrs[i]);
+        if (sb == NULL || !ff_claim (sb)) {
+            continue;
+        }
+        if (owner != a) {
+            ff_push_remote (owner, sb);
+        } else {
+            ff_mark_free (a, sb);
+            fusion(a, sb);
+        }
+    }
+    pthread_mutex_unlock(&a->lock);
+}
+
+
+size_t ff_usable_size(void* ptr)
+{
+    s_block_ptr sb = ff_get_block (ff_owner (ptr), ptr);
+    return sb == NULL ? 0 : ff_size(sb);
+}
+
+
+int ff_set_policy(int policy)
+{
+    if (policy < FF_FIRST_FIT || policy > FF_ADDRESS_FIT) {
+        return -1;
     }
+    return ff_policy = policy;
 }
 
 
-int ff_set_minimum(int min)
+long ff_set_minimum(long min)
 {
+    pthread_mutex_lock(&ff_limits_lock);
     if (ff_max_limit == -1 || min <= ff_max_limit)
     {
-        ff_min_limit = MAX(0, min);
+        __atomic_store_n(&ff_min_limit, MAX(0L, min), __ATOMIC_RELAXED);
     }
-    return ff_min_limit;
+    long result = ff_min_limit;
+    pthread_mutex_unlock(&ff_limits_lock);
+    return result;
 }
 
 
-int ff_set_maximum(int max)
+long ff_set_maximum(long max)
 {
+    pthread_mutex_lock(&ff_limits_lock);
     if (max == -1)
     {
-        ff_max_limit = -1;
+        __atomic_store_n(&ff_max_limit, -1, __ATOMIC_RELAXED);
     } else if (max > ff_min_limit)
     {
-        ff_max_limit = MAX(1, max);
+        __atomic_store_n(&ff_max_limit, MAX(1L, max), __ATOMIC_RELAXED);
     }
-    return ff_max_limit;
+    long result = ff_max_limit;
+    pthread_mutex_unlock(&ff_limits_lock);
+    return result;
 }
 
-int ff_show_stats_by_type(int is_free){
+size_t ff_show_stats_by_type(struct ff_arena *a, int is_free){
 
-    s_block_ptr first = (s_block_ptr) b_list.first;
-    s_block_ptr temp = (s_block_ptr) b_list.first;
-    
-    unsigned total_size = 0;
+    /* the blocks are walked in address order */
+    s_block_ptr temp = a->heap.base < a->heap.top ? (s_block_ptr) a->heap.base : NULL;
+    size_t total_size = 0;
 
     if(is_free){
         printf("showing free blocks:\n");
@@ -380,26 +1158,83 @@ int ff_show_stats_by_type(int is_free){
         printf("showing allocated blocks:\n");
     }
 
-    while (1){
-        if (b_list.first == NULL){
-            break;
+    while (temp != NULL){
+        size_t size = ff_size(temp);
+        if (ff_is_free(temp) == is_free){
+            printf("start_address: %p, end_address: %p, size: %10lu\n", temp->data, temp->data + size, size);
+            total_size += size;
         }
-        if (temp->is_free == is_free){
-            printf("start_address: %p, end_address: %p, size: %10lu\n", temp->ptr, temp->ptr + temp->size, temp->size);
-            total_size += temp->size;
+        temp = ff_next(a, temp);
+    }
+    return total_size;
+}
+
+void ff_get_stats(struct my_heap_stats *stats){
+    pthread_once(&ff_arenas_once, &ff_init_arenas);
+    int count = arena_get_count();
+    for (int i = 0; i < count; i++) {
+        struct ff_arena *a = &ff_arenas[i];
+        pthread_mutex_lock(&a->lock);
+        heap_counters_add(stats, &a->counters);
+        stats->heap_size += a->heap.top - a->heap.base;
+        if (a->class_map != 0) {
+            /* the largest free block is in the highest non-empty class, its
+               list is only walked if its largest block was taken since */
+            int c = 63 - __builtin_clzl(a->class_map);
+            if (a->max_stale & (1UL << c)) {
+                a->class_max[c] = 0;
+                for (s_block_ptr sb = a->free_lists[c]; sb != NULL; sb = sb->next_free) {
+                    a->class_max[c] = MAX(a->class_max[c], ff_size(sb));
+                }
+                a->max_stale &= ~(1UL << c);
+            }
+            stats->largest_free_block = MAX(stats->largest_free_block, a->class_max[c]);
         }
-        if (temp->next == NULL){
-            break;
+        if (i == 0) {
+            stats->heap_top = a->heap.top;
         }
-        temp = (s_block_ptr)(temp->next);
+        pthread_mutex_unlock(&a->lock);
+    }
+}
+
+void ff_fork_lock(){
+    pthread_once(&ff_arenas_once, &ff_init_arenas);
+    pthread_mutex_lock(&ff_limits_lock);
+    for (int i = 0; i < MAX_ARENAS; i++) {
+        pthread_mutex_lock(&ff_arenas[i].lock);
+    }
+}
+
+void ff_fork_unlock(int child){
+    for (int i = 0; i < MAX_ARENAS; i++) {
+        if (child) {
+            pthread_mutex_init(&ff_arenas[i].lock, NULL);
+        } else {
+            pthread_mutex_unlock(&ff_arenas[i].lock);
+        }
+    }
+    if (child) {
+        pthread_mutex_init(&ff_limits_lock, NULL);
+    } else {
+        pthread_mutex_unlock(&ff_limits_lock);
     }
-    return total_size;
 }
 
 void ff_show_stats(){
-    unsigned allocated = ff_show_stats_by_type(0);
-    unsigned not_allocated = ff_show_stats_by_type(1);
-    printf("total allocated: %d\ntotal free: %d\n", allocated, not_allocated);
-    void* sbrk_pointer = sbrk(0);
-    printf("sbrk pointer and allocated + free difference: %ld\n", (long) (sbrk_pointer - (allocated + not_allocated)));
+    pthread_once(&ff_arenas_once, &ff_init_arenas);
+    int count = arena_get_count();
+    for (int i = 0; i < count; i++) {
+        struct ff_arena *a = &ff_arenas[i];
+        pthread_mutex_lock(&a->lock);
+        ff_drain (a);
+        if (count > 1) {
+            printf("arena %d:\n", i);
+        }
+        size_t allocated = ff_show_stats_by_type(a, 0);
+        size_t not_allocated = ff_show_stats_by_type(a, 1);
+        size_t heap_size = a->heap.top - a->heap.base;
+        pthread_mutex_unlock(&a->lock);
+        printf("total allocated: %lu\ntotal free: %lu\n", allocated, not_allocated);
+        printf("heap size and allocated + free difference: %ld\n", (long) (heap_size - (allocated + not_allocated)));
+    }
 }
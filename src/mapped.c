@@ -0,0 +1,357 @@
+/*
+ * mapped.c
+ *
+ * proper documentation is added for each function (mostly in the header file).
+ */
+
+#define _GNU_SOURCE
+
+#include "mapped.h"
+#include "fill.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* marks a removed entry of the hash set */
+#define MAP_TOMBSTONE ((uintptr_t) 1)
+
+/* initial number of slots of the hash set */
+#define MAP_MIN_SLOTS 64
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/* header of a mapped block (it is right before the user data) */
+struct map_header {
+    /* start of the mapping */
+    char *base;
+    /* length of the whole mapping */
+    size_t length;
+    /* size of the request */
+    size_t size;
+    size_t reserved;
+};
+
+/* live mapped blocks (keyed by the address of their data) */
+struct map_set {
+    uintptr_t *slots;
+    size_t capacity;
+    /* number of live and removed entries */
+    size_t used;
+    size_t count;
+    /* total length of the mappings */
+    size_t bytes;
+};
+
+static struct map_set map_set;
+static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long map_threshold = MAP_DEFAULT_THRESHOLD;
+
+static inline size_t map_hash (uintptr_t key, size_t capacity) {
+    return ((key >> 4) * 0x9e3779b97f4a7c15UL >> 32) & (capacity - 1);
+}
+
+/**
+ * @brief returns the slot of key, or the empty slot where it would be
+ *
+ * NOTE: the set should not be full.
+ */
+static uintptr_t* map_find (struct map_set *set, uintptr_t key) {
+    uintptr_t *tombstone = NULL;
+    for (size_t i = map_hash(key, set->capacity);; i = (i + 1) & (set->capacity - 1)) {
+        uintptr_t *slot = &set->slots[i];
+        if (*slot == key) {
+            return slot;
+        } else if (*slot == 0) {
+            return tombstone != NULL ? tombstone : slot;
+        } else if (*slot == MAP_TOMBSTONE && tombstone == NULL) {
+            tombstone = slot;
+        }
+    }
+}
+
+/**
+ * @brief makes room for one more entry (rehashes without the tombstones)
+ *
+ * The load factor is kept under one half.
+ *
+ * @return int 0 on success and -1 if memory of the set cannot be mapped
+ */
+static int map_reserve (struct map_set *set) {
+    if ((set->used + 1) * 2 <= set->capacity) {
+        return 0;
+    }
+
+    size_t capacity = MAP_MIN_SLOTS;
+    while ((set->count + 1) * 4 > capacity) {
+        capacity *= 2;
+    }
+    uintptr_t *slots = mmap(NULL, capacity * sizeof(uintptr_t), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slots == MAP_FAILED) {
+        return -1;
+    }
+
+    struct map_set grown = {slots, capacity, set->count, set->count, set->bytes};
+    for (size_t i = 0; i < set->capacity; i++) {
+        if (set->slots[i] > MAP_TOMBSTONE) {
+            *map_find(&grown, set->slots[i]) = set->slots[i];
+        }
+    }
+    if (set->slots != NULL) {
+        munmap(set->slots, set->capacity * sizeof(uintptr_t));
+    }
+    *set = grown;
+    return 0;
+}
+
+/**
+ * @brief returns whether ptr can be the data of a mapped block
+ *
+ * It rejects some of the pointers without taking the lock.
+ */
+static inline int map_aligned (void *ptr) {
+    return ptr != NULL && (uintptr_t) ptr % MAP_HEADER_SIZE == 0
+        && __atomic_load_n(&map_set.count, __ATOMIC_RELAXED) != 0;
+}
+
+/**
+ * @brief returns the header of ptr if it is a live mapped block
+ *
+ * NOTE: map_lock should be held.
+ */
+static struct map_header* map_lookup (void *ptr) {
+    uintptr_t key = (uintptr_t) ptr;
+    if (!map_aligned(ptr)) {
+        return NULL;
+    }
+    uintptr_t *slot = map_find(&map_set, key);
+    return *slot == key ? (struct map_header *) ptr - 1 : NULL;
+}
+
+
+void* map_alloc(size_t size, int fill)
+{
+    return map_alloc_aligned(MAP_HEADER_SIZE, size, fill);
+}
+
+
+void* map_alloc_aligned(size_t alignment, size_t size, int fill)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    if (alignment < MAP_HEADER_SIZE || (alignment & (alignment - 1))
+        || size > SIZE_MAX - alignment - page) {
+        return NULL;
+    }
+    /* the data is at most `alignment` bytes after the start of the mapping */
+    size_t length = (size + alignment + page - 1) & ~(page - 1);
+
+    char *base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    char *ptr = (char *) (((uintptr_t) base + MAP_HEADER_SIZE + alignment - 1)
+                          & ~(uintptr_t) (alignment - 1));
+    struct map_header *header = (struct map_header *) ptr - 1;
+    header->base = base;
+    header->length = length;
+    header->size = size;
+
+    pthread_mutex_lock(&map_lock);
+    if (map_reserve(&map_set) == -1) {
+        pthread_mutex_unlock(&map_lock);
+        munmap(base, length);
+        return NULL;
+    }
+    uintptr_t *slot = map_find(&map_set, (uintptr_t) ptr);
+    if (*slot == 0) {
+        map_set.used++;
+    }
+    *slot = (uintptr_t) ptr;
+    map_set.bytes += length;
+    __atomic_store_n(&map_set.count, map_set.count + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&map_lock);
+
+    /* the pages of a fresh mapping are zero */
+    fill_memory(ptr, fill, size, 1);
+    return ptr;
+}
+
+
+int map_free(void* ptr)
+{
+    if (!map_aligned(ptr)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&map_lock);
+    struct map_header *header = map_lookup(ptr);
+    if (header == NULL) {
+        pthread_mutex_unlock(&map_lock);
+        return 0;
+    }
+    *map_find(&map_set, (uintptr_t) ptr) = MAP_TOMBSTONE;
+    map_set.bytes -= header->length;
+    __atomic_store_n(&map_set.count, map_set.count - 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&map_lock);
+
+    munmap(header->base, header->length);
+    return 1;
+}
+
+
+void* map_realloc(void* ptr, size_t size, int fill)
+{
+    if (!map_aligned(ptr)) {
+        return NULL;
+    }
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    pthread_mutex_lock(&map_lock);
+    struct map_header *header = map_lookup(ptr);
+    /* room for the entry of the block when it moves (see below) */
+    if (header == NULL || map_reserve(&map_set) == -1) {
+        pthread_mutex_unlock(&map_lock);
+        return NULL;
+    }
+    char *base = header->base;
+    size_t offset = (char *) ptr - base;
+    size_t old_length = header->length;
+    size_t old_size = header->size;
+    if (size > SIZE_MAX - offset - page) {
+        pthread_mutex_unlock(&map_lock);
+        return NULL;
+    }
+    size_t length = (offset + size + page - 1) & ~(page - 1);
+    if (length == old_length) {
+        header->size = size;
+        pthread_mutex_unlock(&map_lock);
+        fill_memory((char *) ptr + old_size, fill, size > old_size ? size - old_size : 0, 0);
+        return ptr;
+    }
+    /* the block is taken out of the set while it is remapped, so it is not
+       found at an address which may be unmapped already */
+    *map_find(&map_set, (uintptr_t) ptr) = MAP_TOMBSTONE;
+    map_set.bytes -= old_length;
+    __atomic_store_n(&map_set.count, map_set.count - 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&map_lock);
+
+    /* the pages are moved (or the mapping is extended) instead of copied */
+    char *new_base = mremap(base, old_length, length, MREMAP_MAYMOVE);
+    int failed = new_base == MAP_FAILED;
+    if (failed) {
+        new_base = base;
+        length = old_length;
+    }
+    char *new_ptr = new_base + offset;
+    header = (struct map_header *) new_ptr - 1;
+    header->base = new_base;
+    header->length = length;
+    if (!failed) {
+        header->size = size;
+    }
+
+    pthread_mutex_lock(&map_lock);
+    uintptr_t *slot = map_find(&map_set, (uintptr_t) new_ptr);
+    if (*slot == 0) {
+        map_set.used++;
+    }
+    *slot = (uintptr_t) new_ptr;
+    map_set.bytes += length;
+    __atomic_store_n(&map_set.count, map_set.count + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&map_lock);
+
+    if (failed) {
+        return NULL;
+    }
+    if (size > old_size) {
+        /* the pages after the old mapping are zero */
+        size_t old_end = old_length - offset;
+        fill_memory(new_ptr + old_size, fill, MIN(size, old_end) - old_size, 0);
+        if (size > old_end) {
+            fill_memory(new_ptr + old_end, fill, size - old_end, 1);
+        }
+    }
+    return new_ptr;
+}
+
+
+size_t map_usable_size(void* ptr)
+{
+    if (!map_aligned(ptr)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&map_lock);
+    struct map_header *header = map_lookup(ptr);
+    size_t usable = header == NULL ? 0 : header->base + header->length - (char *) ptr;
+    pthread_mutex_unlock(&map_lock);
+    return usable;
+}
+
+
+long map_set_threshold(long threshold)
+{
+    if (threshold < -1) {
+        threshold = -1;
+    }
+    __atomic_store_n(&map_threshold, threshold, __ATOMIC_RELAXED);
+    return threshold;
+}
+
+
+int map_should_map(size_t size)
+{
+    long threshold = __atomic_load_n(&map_threshold, __ATOMIC_RELAXED);
+    return threshold != -1 && size >= (size_t) threshold;
+}
+
+
+void map_get_stats(struct my_heap_stats *stats)
+{
+    pthread_mutex_lock(&map_lock);
+    stats->mapped_bytes += map_set.bytes;
+    stats->mapped_blocks += map_set.count;
+    pthread_mutex_unlock(&map_lock);
+}
+
+
+void map_fork_lock()
+{
+    pthread_mutex_lock(&map_lock);
+}
+
+
+void map_fork_unlock(int child)
+{
+    if (child) {
+        pthread_mutex_init(&map_lock, NULL);
+    } else {
+        pthread_mutex_unlock(&map_lock);
+    }
+}
+
+
+size_t map_show_stats()
+{
+    size_t total_size = 0;
+    pthread_mutex_lock(&map_lock);
+    if (map_set.count != 0) {
+        printf("showing mapped blocks:\n");
+    }
+    for (size_t i = 0; i < map_set.capacity; i++) {
+        if (map_set.slots[i] > MAP_TOMBSTONE) {
+            struct map_header *header = (struct map_header *) map_set.slots[i] - 1;
+            printf("start_address: %p, end_address: %p, size: %10lu\n",
+                   (void *) (header + 1), header->base + header->length, header->length);
+            total_size += header->length;
+        }
+    }
+    pthread_mutex_unlock(&map_lock);
+    return total_size;
+}
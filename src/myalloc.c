@@ -0,0 +1,519 @@
+/*
+ * myalloc.c
+ *
+ * proper documentation is added for each function (mostly in the header file).
+ */
+
+#include "myalloc.h"
+
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define ALG_CHECK if (!alg.is_defined) \
+    { \
+        alg.is_defined = 1; \
+    }
+
+struct AlgorithmWrapper
+{
+    int is_defined;
+    void* (*my_malloc)(size_t, int);
+    void* (*aligned_alloc)(size_t, size_t, int);
+    void* (*my_realloc)(void*, size_t, int);
+    void  (*my_free)(void*);
+    int   (*free_sized)(void*, size_t);
+    size_t (*malloc_batch)(size_t, size_t, void**, int);
+    void  (*free_batch)(void**, size_t);
+    size_t (*usable_size)(void*);
+    void (*show_stats)();
+    void (*get_stats)(struct my_heap_stats*);
+    long  (*set_maximum)(long);
+    long  (*set_minimum)(long);
+    /* copy of the limits, requests out of them do not use the thread cache */
+    long  min_limit;
+    long  max_limit;
+};
+
+static struct AlgorithmWrapper alg = {0,
+    &ff_malloc,
+    &ff_aligned_alloc,
+    &ff_realloc,
+    &ff_free,
+    &ff_free_sized,
+    &ff_malloc_batch,
+    &ff_free_batch,
+    &ff_usable_size,
+    &ff_show_stats,
+    &ff_get_stats,
+    &ff_set_maximum,
+    &ff_set_minimum,
+    0,
+    -1
+};
+
+/* whether my_free_sized checks the size against the block (see set_debug) */
+static int debug_checks = 0;
+
+
+int set_algorithm(const char *algorithm)
+{
+    if (alg.is_defined) {
+        errno = EMLINK;
+        return -1;
+    }
+
+    if (strcasecmp(algorithm, "firstfit") == 0)
+    {
+        alg.is_defined = 1;
+        return 1;
+    } else if (strcasecmp(algorithm, "bestfit") == 0)
+    {
+        ff_set_policy(FF_BEST_FIT);
+        return alg.is_defined = 3;
+    } else if (strcasecmp(algorithm, "nextfit") == 0)
+    {
+        ff_set_policy(FF_NEXT_FIT);
+        return alg.is_defined = 4;
+    } else if (strcasecmp(algorithm, "addressfit") == 0)
+    {
+        ff_set_policy(FF_ADDRESS_FIT);
+        return alg.is_defined = 5;
+    } else if (strcasecmp(algorithm, "buddy") == 0)
+    {
+        alg = (struct AlgorithmWrapper) {
+            2,
+            &bud_malloc,
+            &bud_aligned_alloc,
+            &bud_realloc,
+            &bud_free,
+            &bud_free_sized,
+            &bud_malloc_batch,
+            &bud_free_batch,
+            &bud_usable_size,
+            &bud_show_stats,
+            &bud_get_stats,
+            &bud_set_maximum,
+            &bud_set_minimum,
+            0,
+            -1
+        };
+        return 2;
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+int set_arenas(int count)
+{
+    return arena_set_count(count);
+}
+
+long set_mmap_threshold(long threshold)
+{
+    return map_set_threshold(threshold);
+}
+
+int set_trace(const char *path)
+{
+    return trace_open(path);
+}
+
+long set_slab_limit(long limit)
+{
+    return slab_set_limit(limit);
+}
+
+int set_debug(int enabled)
+{
+    __atomic_store_n(&debug_checks, enabled != 0, __ATOMIC_RELAXED);
+    return enabled != 0;
+}
+
+/* frees a block of the slabs or of the algorithm (used by the thread cache),
+   my_free_sized may also cache a mapped block if the threshold was changed */
+static void release_block(void* ptr)
+{
+    if (slab_usable_size(ptr) != 0)
+    {
+        slab_free(ptr);
+    } else if ((*alg.usable_size)(ptr) != 0 || !map_free(ptr))
+    {
+        (*alg.my_free)(ptr);
+    }
+}
+
+/* whether a request may skip the algorithm (see dispatch_malloc) */
+static inline int in_limits(size_t size)
+{
+    return size >= (size_t) alg.min_limit && (alg.max_limit == -1 || size <= (size_t) alg.max_limit);
+}
+
+static void* dispatch_malloc(size_t size, int fill)
+{
+    if (in_limits(size))
+    {
+        void* ptr = tcache_get(size);
+        if (ptr != NULL)
+        {
+            // a cached block was used before
+            fill_memory(ptr, fill, size, 0);
+            return ptr;
+        }
+        if (slab_should_use(size))
+        {
+            ptr = slab_alloc(size, fill);
+            if (ptr != NULL)
+            {
+                return ptr;
+            }
+        }
+        if (map_should_map(size))
+        {
+            return map_alloc(size, fill);
+        }
+    }
+    return (*alg.my_malloc)(size, fill);
+}
+
+static void* slab_realloc(void* ptr, size_t size, size_t usable, int fill)
+{
+    if (size == 0)
+    {
+        slab_free(ptr);
+        return NULL;
+    }
+    if (size <= usable && slab_should_use(size))
+    {
+        return ptr;
+    }
+    void* new_ptr = dispatch_malloc(size, fill);
+    if (new_ptr != NULL)
+    {
+        memcpy(new_ptr, ptr, usable < size ? usable : size);
+        slab_free(ptr);
+    }
+    return new_ptr;
+}
+
+static void* dispatch_realloc(void* ptr, size_t size, int fill)
+{
+    size_t slab = slab_usable_size(ptr);
+    if (slab != 0)
+    {
+        return slab_realloc(ptr, size, slab, fill);
+    }
+
+    size_t usable = ptr == NULL ? 0 : (*alg.usable_size)(ptr);
+    size_t mapped = 0;
+    if (usable != 0 && size > usable && in_limits(size) && map_should_map(size))
+    { // the block grows out of the heap, later it is resized with mremap
+        void* new_ptr = map_alloc(size, NO_FILL);
+        if (new_ptr != NULL)
+        {
+            memcpy(new_ptr, ptr, usable);
+            fill_memory((char *) new_ptr + usable, fill, size - usable, 1);
+            (*alg.my_free)(ptr);
+            return new_ptr;
+        }
+    }
+    if (ptr == NULL || usable != 0 || (mapped = map_usable_size(ptr)) == 0)
+    {
+        return (*alg.my_realloc)(ptr, size, fill);
+    }
+
+    if (size == 0)
+    {
+        map_free(ptr);
+        return NULL;
+    }
+    if (map_should_map(size))
+    {
+        return map_realloc(ptr, size, fill);
+    }
+    void* new_ptr = dispatch_malloc(size, fill);
+    if (new_ptr != NULL)
+    {
+        memcpy(new_ptr, ptr, mapped < size ? mapped : size);
+        map_free(ptr);
+    }
+    return new_ptr;
+}
+
+void* my_malloc(size_t size, int fill)
+{
+    ALG_CHECK;
+    void* ptr = dispatch_malloc(size, fill);
+    if (trace_active())
+    {
+        trace_alloc(ptr, size, 0);
+    }
+    return ptr;
+}
+
+void* my_aligned_alloc(size_t alignment, size_t size, int fill)
+{
+    ALG_CHECK;
+    if (alignment == 0 || (alignment & (alignment - 1)))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    void* ptr;
+    if (in_limits(size) && map_should_map(size))
+    {
+        ptr = map_alloc_aligned(alignment < MAP_HEADER_SIZE ? MAP_HEADER_SIZE : alignment, size, fill);
+    } else {
+        ptr = (*alg.aligned_alloc)(alignment, size, fill);
+    }
+    if (trace_active())
+    {
+        trace_alloc(ptr, size, alignment);
+    }
+    return ptr;
+}
+
+void* my_realloc(void* ptr, size_t size, int fill)
+{
+    ALG_CHECK;
+    if (!trace_active())
+    {
+        return dispatch_realloc(ptr, size, fill);
+    }
+    if (ptr != NULL && size == 0)
+    {
+        trace_free(ptr);
+        return dispatch_realloc(ptr, size, fill);
+    }
+    /* the old address may be reused by other threads as soon as it is freed */
+    uint32_t id = trace_take(ptr);
+    void* new_ptr = dispatch_realloc(ptr, size, fill);
+    trace_realloc(id, ptr, new_ptr, size);
+    return new_ptr;
+}
+
+static void dispatch_free(void* ptr)
+{
+    size_t slab = slab_usable_size(ptr);
+    if (slab != 0)
+    {
+        if (!tcache_put(ptr, slab, &release_block))
+        {
+            slab_free(ptr);
+        }
+        return;
+    }
+    size_t usable = (*alg.usable_size)(ptr);
+    if (usable != 0 && tcache_put(ptr, usable, &release_block))
+    {
+        return;
+    }
+    if (usable == 0 && map_free(ptr))
+    {
+        return;
+    }
+    (*alg.my_free)(ptr);
+}
+
+void my_free(void* ptr)
+{
+    ALG_CHECK;
+    if (trace_active())
+    {
+        trace_free(ptr);
+    }
+    dispatch_free(ptr);
+}
+
+void my_free_sized(void* ptr, size_t size)
+{
+    ALG_CHECK;
+    if (ptr == NULL)
+    {
+        return;
+    }
+    if (__atomic_load_n(&debug_checks, __ATOMIC_RELAXED))
+    {
+        size_t usable = my_usable_size(ptr);
+        if (usable == 0 || usable < size)
+        {
+            fprintf(stderr, "my_free_sized: %p is freed with size %zu but has %zu usable bytes\n",
+                    ptr, size, usable);
+            abort();
+        }
+    }
+    if (trace_active())
+    {
+        trace_free(ptr);
+    }
+
+    if (!in_limits(size))
+    { // the block was allocated before the limits were changed
+        dispatch_free(ptr);
+        return;
+    }
+    if (map_should_map(size))
+    {
+        if (map_free(ptr))
+        {
+            return;
+        }
+    } else if (tcache_put(ptr, (size + TC_GRANULE - 1) & ~(size_t) (TC_GRANULE - 1), &release_block))
+    { // every usable size (but of mapped blocks) is a multiple of TC_GRANULE
+        return;
+    }
+    if (!(*alg.free_sized)(ptr, size))
+    { // a slab object or a mapped block
+        dispatch_free(ptr);
+    }
+}
+
+size_t my_malloc_batch(size_t size, size_t count, void** out, int fill)
+{
+    ALG_CHECK;
+    size_t done = 0;
+    if (in_limits(size) && slab_should_use(size))
+    {
+        for (; done < count; done++)
+        {
+            if ((out[done] = slab_alloc(size, fill)) == NULL)
+            {
+                break;
+            }
+        }
+    } else if (in_limits(size) && map_should_map(size))
+    {
+        for (; done < count; done++)
+        {
+            if ((out[done] = map_alloc(size, fill)) == NULL)
+            {
+                break;
+            }
+        }
+        // a failed mapping is not retried by the algorithm
+        count = done;
+    }
+    if (done < count)
+    {
+        done += (*alg.malloc_batch)(size, count - done, out + done, fill);
+    }
+    if (trace_active())
+    {
+        for (size_t i = 0; i < done; i++)
+        {
+            trace_alloc(out[i], size, 0);
+        }
+    }
+    return done;
+}
+
+void my_free_batch(void** ptrs, size_t count)
+{
+    ALG_CHECK;
+    /* blocks of the algorithm are passed on in groups */
+    void* heap[64];
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        void* ptr = ptrs[i];
+        if (trace_active())
+        {
+            trace_free(ptr);
+        }
+        if (slab_usable_size(ptr) != 0)
+        {
+            slab_free(ptr);
+        } else if ((*alg.usable_size)(ptr) != 0)
+        {
+            heap[n++] = ptr;
+            if (n == 64)
+            {
+                (*alg.free_batch)(heap, n);
+                n = 0;
+            }
+        } else {
+            map_free(ptr);
+        }
+    }
+    (*alg.free_batch)(heap, n);
+}
+
+size_t my_usable_size(void* ptr)
+{
+    ALG_CHECK;
+    size_t usable = slab_usable_size(ptr);
+    if (usable == 0)
+    {
+        usable = (*alg.usable_size)(ptr);
+    }
+    return usable != 0 ? usable : map_usable_size(ptr);
+}
+
+void my_fork_prepare()
+{
+    trace_fork_lock();
+    ff_fork_lock();
+    bud_fork_lock();
+    slab_fork_lock();
+    map_fork_lock();
+}
+
+void my_fork_parent()
+{
+    map_fork_unlock(0);
+    slab_fork_unlock(0);
+    bud_fork_unlock(0);
+    ff_fork_unlock(0);
+    trace_fork_unlock(0);
+}
+
+void my_fork_child()
+{
+    map_fork_unlock(1);
+    slab_fork_unlock(1);
+    bud_fork_unlock(1);
+    ff_fork_unlock(1);
+    trace_fork_unlock(1);
+}
+
+void show_stats()
+{
+    ALG_CHECK;
+    (*alg.show_stats)();
+    size_t mapped = map_show_stats();
+    if (mapped != 0)
+    {
+        printf("total mapped: %lu\n", mapped);
+    }
+    struct my_heap_stats slabs = {0};
+    slab_get_stats(&slabs);
+    if (slabs.slab_bytes != 0)
+    {
+        printf("slabs: %lu bytes, %lu objects\n", slabs.slab_bytes, slabs.slab_objects);
+    }
+}
+
+void my_get_stats(struct my_heap_stats *stats)
+{
+    ALG_CHECK;
+    memset(stats, 0, sizeof(*stats));
+    (*alg.get_stats)(stats);
+    map_get_stats(stats);
+    slab_get_stats(stats);
+    stats->metadata_bytes = stats->heap_size - stats->in_use_bytes - stats->free_bytes;
+    stats->internal_fragmentation = stats->in_use_bytes - stats->requested_bytes;
+}
+
+long set_maximum(long value)
+{
+    ALG_CHECK;
+    return alg.max_limit = (*alg.set_maximum)(value);
+}
+
+long set_minimum(long value)
+{
+    ALG_CHECK;
+    return alg.min_limit = (*alg.set_minimum)(value);
+}
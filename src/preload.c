@@ -0,0 +1,248 @@
+/*
+ * preload.c
+ *
+ * Drop-in replacement of the standard allocation functions. It is built as a
+ * shared library (libmyalloc.so) which can be loaded in front of the C
+ * library to run unmodified programs on top of myalloc:
+ *
+ *      MYALLOC_ALGORITHM=buddy LD_PRELOAD=./libmyalloc.so program
+ *
+ * The configuration comes from the environment since the program does not
+ * know about set_algorithm and the others:
+ *
+ *      MYALLOC_ALGORITHM       "firstfit" (default), "buddy" or another name
+ *                              of set_algorithm
+ *      MYALLOC_ARENAS          number of arenas (0 for one per CPU)
+ *      MYALLOC_MMAP_THRESHOLD  see set_mmap_threshold
+ *      MYALLOC_SLAB            see set_slab_limit
+ *      MYALLOC_TRACE           records the allocations into this file
+ *
+ * Only the functions of this file are exported from the library, so the
+ * names of the algorithms cannot clash with the names of the program.
+ *
+ * Like the malloc of the C library, every lock is taken around fork (see
+ * my_fork_prepare), so the child of a multithreaded program can allocate.
+ */
+
+#include "myalloc.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PRELOAD_API __attribute__((visibility("default")))
+
+/* alignment of every block returned by malloc */
+#define PRELOAD_ALIGN 16
+
+static pthread_once_t preload_once = PTHREAD_ONCE_INIT;
+
+static void preload_init()
+{
+    int saved_errno = errno;
+    /* nobody else moves the program break, so the main arena can use it */
+    arena_set_brk(1);
+    /* a thread may hold a lock of the library while another one forks */
+    pthread_atfork(&my_fork_prepare, &my_fork_parent, &my_fork_child);
+    const char *algorithm = getenv("MYALLOC_ALGORITHM");
+    if (algorithm != NULL)
+    {
+        set_algorithm(algorithm);
+    }
+    const char *arenas = getenv("MYALLOC_ARENAS");
+    if (arenas != NULL)
+    {
+        set_arenas(atoi(arenas));
+    }
+    const char *threshold = getenv("MYALLOC_MMAP_THRESHOLD");
+    if (threshold != NULL)
+    {
+        set_mmap_threshold(atol(threshold));
+    }
+    const char *slab = getenv("MYALLOC_SLAB");
+    if (slab != NULL)
+    {
+        set_slab_limit(atol(slab));
+    }
+    const char *trace = getenv("MYALLOC_TRACE");
+    if (trace != NULL)
+    {
+        set_trace(trace);
+    }
+    const char *debug = getenv("MYALLOC_DEBUG");
+    if (debug != NULL)
+    {
+        set_debug(atoi(debug));
+    }
+    errno = saved_errno;
+}
+
+/**
+ * @brief rounds a request up, so every block (and the next one) is aligned
+ *
+ * malloc(0) should return a unique pointer, so it gets the smallest block.
+ *
+ * @return size_t 0 if the request is too big
+ */
+static inline size_t preload_size(size_t size)
+{
+    if (size > SIZE_MAX - PRELOAD_ALIGN)
+        return 0;
+    return size == 0 ? PRELOAD_ALIGN : (size + PRELOAD_ALIGN - 1) & ~(size_t) (PRELOAD_ALIGN - 1);
+}
+
+/**
+ * @brief allocates `size` bytes
+ *
+ * malloc does not need any fill (NO_FILL) and calloc needs zero, which is
+ * free for memory that is known to be zero.
+ */
+static void* preload_malloc(size_t size, int fill)
+{
+    pthread_once(&preload_once, &preload_init);
+    size = preload_size(size);
+    void *ptr = size == 0 ? NULL : my_malloc(size, fill);
+    if (ptr == NULL)
+        errno = ENOMEM;
+    return ptr;
+}
+
+/**
+ * @brief allocates `size` bytes at a multiple of alignment
+ *
+ * @return int 0 on success or the error number
+ */
+static int preload_aligned(void **out, size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)))
+        return EINVAL;
+
+    if (alignment <= PRELOAD_ALIGN)
+    {
+        *out = preload_malloc(size, NO_FILL);
+    } else {
+        pthread_once(&preload_once, &preload_init);
+        size = preload_size(size);
+        *out = size == 0 ? NULL : my_aligned_alloc(alignment, size, NO_FILL);
+    }
+    return *out == NULL ? ENOMEM : 0;
+}
+
+PRELOAD_API void* malloc(size_t size)
+{
+    return preload_malloc(size, NO_FILL);
+}
+
+PRELOAD_API void free(void* ptr)
+{
+    if (ptr == NULL)
+        return;
+    int saved_errno = errno;
+    my_free(ptr);
+    errno = saved_errno;
+}
+
+/* C23, size is the size given to malloc, calloc or realloc */
+PRELOAD_API void free_sized(void* ptr, size_t size)
+{
+    if (ptr == NULL)
+        return;
+    int saved_errno = errno;
+    my_free_sized(ptr, preload_size(size));
+    errno = saved_errno;
+}
+
+/* C23, for the blocks of aligned_alloc */
+PRELOAD_API void free_aligned_sized(void* ptr, size_t alignment, size_t size)
+{
+    (void) alignment;
+    free_sized(ptr, size);
+}
+
+PRELOAD_API void* calloc(size_t count, size_t size)
+{
+    size_t total;
+    if (__builtin_mul_overflow(count, size, &total))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return preload_malloc(total, 0);
+}
+
+PRELOAD_API void* realloc(void* ptr, size_t size)
+{
+    if (ptr == NULL)
+        return preload_malloc(size, NO_FILL);
+    if (size == 0)
+    {
+        free(ptr);
+        return NULL;
+    }
+
+    pthread_once(&preload_once, &preload_init);
+    size = preload_size(size);
+    void *new_ptr = size == 0 ? NULL : my_realloc(ptr, size, NO_FILL);
+    if (new_ptr == NULL)
+        errno = ENOMEM;
+    return new_ptr;
+}
+
+PRELOAD_API void* reallocarray(void* ptr, size_t count, size_t size)
+{
+    size_t total;
+    if (__builtin_mul_overflow(count, size, &total))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, total);
+}
+
+PRELOAD_API int posix_memalign(void** out, size_t alignment, size_t size)
+{
+    if (alignment % sizeof(void *) != 0)
+        return EINVAL;
+    void *ptr;
+    int error = preload_aligned(&ptr, alignment, size);
+    if (error == 0)
+        *out = ptr;
+    return error;
+}
+
+PRELOAD_API void* aligned_alloc(size_t alignment, size_t size)
+{
+    void *ptr;
+    int error = preload_aligned(&ptr, alignment, size);
+    if (error != 0)
+    {
+        errno = error;
+        return NULL;
+    }
+    return ptr;
+}
+
+PRELOAD_API void* memalign(size_t alignment, size_t size)
+{
+    return aligned_alloc(alignment, size);
+}
+
+PRELOAD_API void* valloc(size_t size)
+{
+    return aligned_alloc(sysconf(_SC_PAGESIZE), size);
+}
+
+PRELOAD_API void* pvalloc(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    return aligned_alloc(page, (size + page - 1) & ~(page - 1));
+}
+
+PRELOAD_API size_t malloc_usable_size(void* ptr)
+{
+    return ptr == NULL ? 0 : my_usable_size(ptr);
+}
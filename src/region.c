@@ -0,0 +1,155 @@
+/*
+ * region.c
+ *
+ * proper documentation is added for each function (mostly in the header file).
+ */
+
+#include "region.h"
+
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* accessible pages of REGION_MMAP regions are added in steps of this size */
+#define REGION_COMMIT_STEP (64UL << 10)
+
+static char* page_align(char *ptr, size_t step)
+{
+    return (char *) (((uintptr_t) ptr + step - 1) & ~(uintptr_t) (step - 1));
+}
+
+
+void region_init(struct region *r, int kind)
+{
+    r->kind = kind;
+    r->base = r->top = r->committed = r->end = NULL;
+}
+
+
+/**
+ * @brief reserves the address space of a REGION_MMAP region
+ * 
+ * If REGION_RESERVE bytes cannot be reserved (e.g. because of RLIMIT_AS),
+ * smaller reservations are tried.
+ */
+static int region_reserve(struct region *r)
+{
+    for (size_t size = REGION_RESERVE; size >= REGION_COMMIT_STEP; size >>= 1)
+    {
+        void *mem = mmap(NULL, size, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem != MAP_FAILED)
+        {
+            r->committed = (char *) mem;
+            r->end = (char *) mem + size;
+            __atomic_store_n(&r->top, (char *) mem, __ATOMIC_RELEASE);
+            __atomic_store_n(&r->base, (char *) mem, __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+void* region_grow(struct region *r, size_t size)
+{
+    char *old_top = r->top;
+    if (r->kind == REGION_BRK)
+    {
+        char *brk_top = sbrk(0);
+        if (r->base == NULL)
+        { // the blocks need an aligned start
+            size_t pad = -(uintptr_t) brk_top & (REGION_ALIGN - 1);
+            if (pad != 0 && sbrk(pad) == (void *) -1)
+                return NULL;
+            brk_top += pad;
+            old_top = brk_top;
+        } else if (brk_top != (void *) r->top) {
+            return NULL; // someone else moved the break
+        }
+        if ((intptr_t) size < 0 || sbrk(size) == (void *) -1)
+            return NULL;
+        if (r->base == NULL)
+            __atomic_store_n(&r->base, old_top, __ATOMIC_RELEASE);
+        __atomic_store_n(&r->top, old_top + size, __ATOMIC_RELEASE);
+        return old_top;
+    }
+
+    if (r->base == NULL)
+    {
+        if (region_reserve(r) == -1)
+            return NULL;
+        old_top = r->top;
+    }
+    if (size > (size_t) (r->end - old_top))
+        return NULL;
+
+    char *new_top = old_top + size;
+    if (new_top > r->committed)
+    {
+        char *committed = page_align(new_top, REGION_COMMIT_STEP);
+        if (committed > r->end)
+            committed = r->end;
+        if (mprotect(r->committed, committed - r->committed,
+                     PROT_READ | PROT_WRITE) == -1)
+            return NULL;
+        r->committed = committed;
+    }
+    __atomic_store_n(&r->top, new_top, __ATOMIC_RELEASE);
+    return old_top;
+}
+
+
+int region_trim(struct region *r, void *new_top)
+{
+    char *top = (char *) new_top;
+    if (r->base == NULL || top < r->base || top > r->top)
+        return -1;
+
+    /* the rest of the page of the new top is kept, it should be zero like
+       the memory after it */
+    char *page_end = page_align(top, sysconf(_SC_PAGESIZE));
+    char *old_top = r->top;
+
+    if (r->kind == REGION_BRK)
+    {
+        if (sbrk(0) != (void *) r->top || brk(top) == -1)
+            return -1;
+        memset(top, 0, (page_end < old_top ? page_end : old_top) - top);
+        __atomic_store_n(&r->top, top, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    __atomic_store_n(&r->top, top, __ATOMIC_RELEASE);
+    memset(top, 0, (page_end < old_top ? page_end : old_top) - top);
+    char *keep = page_align(top, REGION_COMMIT_STEP);
+    if (page_end < keep && page_end < old_top)
+    { // the pages which stay accessible are zero when they are touched again
+        madvise(page_end, (keep < old_top ? keep : old_top) - page_end, MADV_DONTNEED);
+    }
+    if (keep < r->committed)
+    { // give the pages back and make them inaccessible again
+        size_t length = r->committed - keep;
+        madvise(keep, length, MADV_DONTNEED);
+        mprotect(keep, length, PROT_NONE);
+        r->committed = keep;
+    }
+    return 0;
+}
+
+
+int region_release(void *start, void *end)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    char *first = page_align((char *) start, page);
+    char *last = (char *) ((uintptr_t) end & ~(uintptr_t) (page - 1));
+    if (first >= last)
+        return -1;
+
+    if (madvise(first, last - first, MADV_DONTNEED) == -1)
+        return -1;
+    memset(start, 0, first - (char *) start);
+    memset(last, 0, (char *) end - last);
+    return 0;
+}
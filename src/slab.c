@@ -0,0 +1,327 @@
+/*
+ * slab.c
+ *
+ * proper documentation is added for each function (mostly in the header file).
+ */
+
+#include "slab.h"
+#include "fill.h"
+#include "region.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+/* seed of the slab checksums */
+#define SLAB_MAGIC 0x51ab5a110c8ed00dUL
+
+/* words of the free bitmap (enough for the smallest objects) */
+#define SLAB_MAP_WORDS ((SLAB_SIZE / SLAB_GRANULE + 63) / 64)
+
+/* header at the start of every slab */
+struct slab {
+    /* checksum of the address and the object size of a slab in use */
+    uintptr_t magic;
+    /* slabs of the same class with free objects */
+    struct slab *next;
+    struct slab *prev;
+    unsigned size;
+    unsigned count;
+    unsigned used;
+    /* objects from this index on were never allocated (they are zero) */
+    unsigned fresh;
+    /* bit i is set when object i is free */
+    uint64_t free_map[SLAB_MAP_WORDS];
+};
+
+/* objects start after the header */
+#define SLAB_HEADER ((sizeof(struct slab) + SLAB_GRANULE - 1) & ~(size_t) (SLAB_GRANULE - 1))
+
+struct slab_class {
+    pthread_mutex_t lock;
+    /* slabs with free objects */
+    struct slab *partial;
+    /* number of empty slabs in partial */
+    unsigned empty;
+    /* number of slabs and allocated objects */
+    size_t slabs;
+    size_t objects;
+};
+
+static struct slab_class slab_classes[SLAB_CLASSES];
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+
+/* the memory of all slabs and the slabs given back, protected by slab_lock */
+static struct region slab_region;
+static struct slab *slab_spare;
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long slab_limit = SLAB_MAX_SIZE;
+
+static void slab_init () {
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        pthread_mutex_init(&slab_classes[i].lock, NULL);
+    }
+    region_init(&slab_region, REGION_MMAP);
+}
+
+static inline uintptr_t slab_checksum (struct slab *s) {
+    return SLAB_MAGIC ^ (uintptr_t) s ^ s->size;
+}
+
+static inline char* slab_objects (struct slab *s) {
+    return (char *) s + SLAB_HEADER;
+}
+
+/**
+ * @brief returns the slab of ptr if it is in a slab in use
+ */
+static struct slab* slab_of (void *ptr) {
+    if (!region_contains(&slab_region, ptr)) {
+        return NULL;
+    }
+    struct slab *s = (struct slab *) ((uintptr_t) ptr & ~(uintptr_t) (SLAB_SIZE - 1));
+    if (s->magic != slab_checksum(s) || (char *) ptr < slab_objects(s)) {
+        return NULL;
+    }
+    return s;
+}
+
+/**
+ * @brief finds the index of the object at ptr in the slab s
+ *
+ * @return int 0 if ptr is not the start of an object
+ */
+static inline int slab_index (struct slab *s, void *ptr, unsigned *index) {
+    size_t offset = (char *) ptr - slab_objects(s);
+    *index = offset / s->size;
+    return offset % s->size == 0 && *index < s->count;
+}
+
+static void slab_list_insert (struct slab_class *c, struct slab *s) {
+    s->prev = NULL;
+    s->next = c->partial;
+    if (s->next != NULL) {
+        s->next->prev = s;
+    }
+    c->partial = s;
+}
+
+static void slab_list_remove (struct slab_class *c, struct slab *s) {
+    if (s->prev != NULL) {
+        s->prev->next = s->next;
+    } else {
+        c->partial = s->next;
+    }
+    if (s->next != NULL) {
+        s->next->prev = s->prev;
+    }
+    s->next = s->prev = NULL;
+}
+
+/**
+ * @brief makes a new empty slab for objects of `size` bytes
+ *
+ * A spare slab is reused if there is one, otherwise the region grows. Both
+ * are zero (see region.h).
+ *
+ * @return struct slab* NULL on failure
+ */
+static struct slab* slab_new (unsigned size) {
+    pthread_mutex_lock(&slab_lock);
+    struct slab *s = slab_spare;
+    if (s != NULL) {
+        slab_spare = s->next;
+    } else {
+        s = region_grow(&slab_region, SLAB_SIZE);
+    }
+    pthread_mutex_unlock(&slab_lock);
+    if (s == NULL) {
+        return NULL;
+    }
+
+    s->next = s->prev = NULL;
+    s->size = size;
+    s->count = (SLAB_SIZE - SLAB_HEADER) / size;
+    s->used = 0;
+    s->fresh = 0;
+    for (unsigned i = 0; i < SLAB_MAP_WORDS; i++) {
+        unsigned first = i * 64;
+        s->free_map[i] = first >= s->count ? 0
+            : s->count - first >= 64 ? ~0UL : (1UL << (s->count - first)) - 1;
+    }
+    s->magic = slab_checksum(s);
+    return s;
+}
+
+/**
+ * @brief gives the pages of an empty slab back and keeps it as spare
+ */
+static void slab_give_back (struct slab *s) {
+    s->magic = 0;
+    region_release(s, (char *) s + SLAB_SIZE);
+    pthread_mutex_lock(&slab_lock);
+    s->next = slab_spare;
+    slab_spare = s;
+    pthread_mutex_unlock(&slab_lock);
+}
+
+
+void* slab_alloc(size_t size, int fill)
+{
+    if (size == 0 || size > SLAB_MAX_SIZE) {
+        return NULL;
+    }
+    pthread_once(&slab_once, &slab_init);
+    struct slab_class *c = &slab_classes[(size - 1) / SLAB_GRANULE];
+
+    pthread_mutex_lock(&c->lock);
+    struct slab *s = c->partial;
+    if (s == NULL) {
+        s = slab_new(((size - 1) / SLAB_GRANULE + 1) * SLAB_GRANULE);
+        if (s == NULL) {
+            pthread_mutex_unlock(&c->lock);
+            return NULL;
+        }
+        slab_list_insert(c, s);
+        c->slabs++;
+        c->empty++;
+    }
+
+    unsigned word = 0;
+    while (s->free_map[word] == 0) {
+        word++;
+    }
+    unsigned index = word * 64 + __builtin_ctzl(s->free_map[word]);
+    s->free_map[word] &= s->free_map[word] - 1;
+    if (s->used++ == 0) {
+        c->empty--;
+    }
+    if (s->used == s->count) {
+        slab_list_remove(c, s);
+    }
+    /* the lowest free object is taken, so the ones after fresh were never used */
+    int zero = index >= s->fresh;
+    if (zero) {
+        s->fresh = index + 1;
+    }
+    c->objects++;
+    pthread_mutex_unlock(&c->lock);
+
+    char *ptr = slab_objects(s) + (size_t) index * s->size;
+    fill_memory(ptr, fill, size, zero);
+    return ptr;
+}
+
+
+void slab_free(void* ptr)
+{
+    struct slab *s = slab_of(ptr);
+    if (s == NULL) {
+        return;
+    }
+    unsigned index;
+    if (!slab_index(s, ptr, &index)) {
+        return;
+    }
+    struct slab_class *c = &slab_classes[s->size / SLAB_GRANULE - 1];
+    uint64_t bit = 1UL << (index % 64);
+
+    pthread_mutex_lock(&c->lock);
+    if (s->magic != slab_checksum(s) || (s->free_map[index / 64] & bit)) {
+        /* the object is free already (or the slab was given back) */
+        pthread_mutex_unlock(&c->lock);
+        return;
+    }
+    s->free_map[index / 64] |= bit;
+    c->objects--;
+    if (s->used-- == s->count) {
+        slab_list_insert(c, s);
+    }
+    int give_back = 0;
+    if (s->used == 0) {
+        if (c->empty > 0) {
+            slab_list_remove(c, s);
+            c->slabs--;
+            give_back = 1;
+        } else {
+            c->empty++;
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    if (give_back) {
+        slab_give_back(s);
+    }
+}
+
+
+size_t slab_usable_size(void* ptr)
+{
+    struct slab *s = slab_of(ptr);
+    unsigned index;
+    if (s == NULL || !slab_index(s, ptr, &index)) {
+        return 0;
+    }
+    /* the bitmap is read without the lock, like the headers of the heaps */
+    uint64_t map = __atomic_load_n(&s->free_map[index / 64], __ATOMIC_RELAXED);
+    return map & (1UL << (index % 64)) ? 0 : s->size;
+}
+
+
+long slab_set_limit(long limit)
+{
+    if (limit < 0) {
+        limit = 0;
+    } else if (limit > SLAB_MAX_SIZE) {
+        limit = SLAB_MAX_SIZE;
+    }
+    __atomic_store_n(&slab_limit, limit, __ATOMIC_RELAXED);
+    return limit;
+}
+
+
+int slab_should_use(size_t size)
+{
+    return size <= (size_t) __atomic_load_n(&slab_limit, __ATOMIC_RELAXED) && size > 0;
+}
+
+
+void slab_fork_lock()
+{
+    pthread_once(&slab_once, &slab_init);
+    /* a class lock is held while a slab is taken (slab_new) */
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        pthread_mutex_lock(&slab_classes[i].lock);
+    }
+    pthread_mutex_lock(&slab_lock);
+}
+
+
+void slab_fork_unlock(int child)
+{
+    if (child) {
+        pthread_mutex_init(&slab_lock, NULL);
+    } else {
+        pthread_mutex_unlock(&slab_lock);
+    }
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        if (child) {
+            pthread_mutex_init(&slab_classes[i].lock, NULL);
+        } else {
+            pthread_mutex_unlock(&slab_classes[i].lock);
+        }
+    }
+}
+
+
+void slab_get_stats(struct my_heap_stats *stats)
+{
+    pthread_once(&slab_once, &slab_init);
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        struct slab_class *c = &slab_classes[i];
+        pthread_mutex_lock(&c->lock);
+        stats->slab_bytes += c->slabs * SLAB_SIZE;
+        stats->slab_objects += c->objects;
+        pthread_mutex_unlock(&c->lock);
+    }
+}
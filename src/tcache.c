@@ -0,0 +1,111 @@
+/*
+ * tcache.c
+ *
+ * proper documentation is added for each function (mostly in the header file).
+ */
+
+#include "tcache.h"
+
+#include <pthread.h>
+
+/* bookkeeping kept in the first bytes of a cached block */
+struct tc_entry {
+    struct tc_entry *next;
+    /* the cache which holds the block, used to detect double frees */
+    struct tcache *key;
+};
+
+struct tcache {
+    struct tc_entry *bins[TC_CLASSES + 1];
+    unsigned counts[TC_CLASSES + 1];
+    /* function which gives the cached blocks back to the algorithm */
+    void (*release)(void*);
+    /* whether the destructor of this thread is registered */
+    int registered;
+};
+
+static __thread struct tcache tcache;
+
+static pthread_key_t tc_key;
+static pthread_once_t tc_once = PTHREAD_ONCE_INIT;
+
+static void tc_destroy(void *arg)
+{
+    (void) arg;
+    tcache_flush();
+}
+
+static void tc_make_key()
+{
+    pthread_key_create(&tc_key, &tc_destroy);
+}
+
+
+void* tcache_get(size_t size)
+{
+    if (size == 0 || size > TC_MAX_SIZE)
+        return NULL;
+
+    size_t bin = (size + TC_GRANULE - 1) / TC_GRANULE;
+    struct tc_entry *entry = tcache.bins[bin];
+    if (entry == NULL)
+        return NULL;
+
+    tcache.bins[bin] = entry->next;
+    tcache.counts[bin]--;
+    entry->key = NULL;
+    return entry;
+}
+
+
+int tcache_put(void* ptr, size_t usable, void (*release)(void*))
+{
+    size_t bin = usable / TC_GRANULE;
+    if (bin == 0 || bin > TC_CLASSES)
+        return 0;
+
+    struct tc_entry *entry = (struct tc_entry *) ptr;
+    if (entry->key == &tcache)
+    { // it may be a double free (or just stale data), look for it
+        for (struct tc_entry *e = tcache.bins[bin]; e != NULL; e = e->next)
+        {
+            if (e == entry)
+                return 1;
+        }
+    }
+
+    if (tcache.counts[bin] >= TC_BIN_COUNT)
+        return 0;
+
+    if (!tcache.registered)
+    { // flush the cache when this thread exits
+        pthread_once(&tc_once, &tc_make_key);
+        pthread_setspecific(tc_key, &tcache);
+        tcache.registered = 1;
+    }
+    tcache.release = release;
+
+    entry->key = &tcache;
+    entry->next = tcache.bins[bin];
+    tcache.bins[bin] = entry;
+    tcache.counts[bin]++;
+    return 1;
+}
+
+
+void tcache_flush()
+{
+    for (int bin = 1; bin <= TC_CLASSES; bin++)
+    {
+        struct tc_entry *entry = tcache.bins[bin];
+        tcache.bins[bin] = NULL;
+        tcache.counts[bin] = 0;
+        while (entry != NULL)
+        {
+            struct tc_entry *next = entry->next;
+            entry->key = NULL;
+            (*tcache.release)(entry);
+            entry = next;
+        }
+    }
+}
@@ -0,0 +1,328 @@
+/*
+ * trace.c
+ *
+ * proper documentation is added for each function (mostly in the header file).
+ */
+
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/* marks a removed entry of the id table */
+#define TRACE_TOMBSTONE ((uintptr_t) 1)
+
+/* initial number of slots of the id table */
+#define TRACE_MIN_SLOTS 1024
+
+struct trace_slot {
+    uintptr_t ptr;
+    uint32_t id;
+};
+
+/* ids of the live blocks (keyed by their address) */
+struct trace_table {
+    struct trace_slot *slots;
+    size_t capacity;
+    /* number of live and removed entries */
+    size_t used;
+    size_t count;
+};
+
+static struct trace_table trace_table;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int trace_fd = -1;
+/* process which owns the recording (a forked child does not record) */
+static pid_t trace_pid;
+static int trace_running;
+static uint32_t trace_next_id;
+static uint64_t trace_last_ns;
+
+static struct trace_record trace_buffer[TRACE_BUFFER];
+static size_t trace_buffered;
+
+static inline size_t trace_hash (uintptr_t key, size_t capacity) {
+    return ((key >> 4) * 0x9e3779b97f4a7c15UL >> 32) & (capacity - 1);
+}
+
+/**
+ * @brief returns the slot of key, or the empty slot where it would be
+ *
+ * NOTE: the table should not be full.
+ */
+static struct trace_slot* trace_find (struct trace_table *table, uintptr_t key) {
+    struct trace_slot *tombstone = NULL;
+    for (size_t i = trace_hash(key, table->capacity);; i = (i + 1) & (table->capacity - 1)) {
+        struct trace_slot *slot = &table->slots[i];
+        if (slot->ptr == key) {
+            return slot;
+        } else if (slot->ptr == 0) {
+            return tombstone != NULL ? tombstone : slot;
+        } else if (slot->ptr == TRACE_TOMBSTONE && tombstone == NULL) {
+            tombstone = slot;
+        }
+    }
+}
+
+/**
+ * @brief makes room for one more entry (rehashes without the tombstones)
+ *
+ * The table is mapped directly, so it does not allocate through the
+ * allocator which is being traced.
+ *
+ * @return int 0 on success and -1 if memory of the table cannot be mapped
+ */
+static int trace_reserve (struct trace_table *table) {
+    if ((table->used + 1) * 2 <= table->capacity) {
+        return 0;
+    }
+
+    size_t capacity = TRACE_MIN_SLOTS;
+    while ((table->count + 1) * 4 > capacity) {
+        capacity *= 2;
+    }
+    struct trace_slot *slots = mmap(NULL, capacity * sizeof(struct trace_slot),
+                                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slots == MAP_FAILED) {
+        return -1;
+    }
+
+    struct trace_table grown = {slots, capacity, table->count, table->count};
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i].ptr > TRACE_TOMBSTONE) {
+            *trace_find(&grown, table->slots[i].ptr) = table->slots[i];
+        }
+    }
+    if (table->slots != NULL) {
+        munmap(table->slots, table->capacity * sizeof(struct trace_slot));
+    }
+    *table = grown;
+    return 0;
+}
+
+/**
+ * @brief gives ptr the id
+ *
+ * NOTE: trace_lock should be held.
+ */
+static void trace_insert (void *ptr, uint32_t id) {
+    if (trace_reserve(&trace_table) == -1) {
+        /* the block stays unknown */
+        return;
+    }
+    struct trace_slot *slot = trace_find(&trace_table, (uintptr_t) ptr);
+    if (slot->ptr == 0) {
+        trace_table.used++;
+    }
+    if (slot->ptr != (uintptr_t) ptr) {
+        trace_table.count++;
+    }
+    *slot = (struct trace_slot) {(uintptr_t) ptr, id};
+}
+
+/**
+ * @brief removes ptr from the table
+ *
+ * NOTE: trace_lock should be held.
+ *
+ * @return uint32_t id of ptr, 0 if it is unknown
+ */
+static uint32_t trace_remove (void *ptr) {
+    if (trace_table.count == 0) {
+        return 0;
+    }
+    struct trace_slot *slot = trace_find(&trace_table, (uintptr_t) ptr);
+    if (slot->ptr != (uintptr_t) ptr) {
+        return 0;
+    }
+    slot->ptr = TRACE_TOMBSTONE;
+    trace_table.count--;
+    return slot->id;
+}
+
+/**
+ * @brief writes the buffered records
+ *
+ * NOTE: trace_lock should be held.
+ */
+static void trace_flush () {
+    if (getpid() != trace_pid) {
+        trace_buffered = 0;
+        return;
+    }
+    char *data = (char *) trace_buffer;
+    size_t left = trace_buffered * sizeof(struct trace_record);
+    while (left > 0) {
+        ssize_t written = write(trace_fd, data, left);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        } else if (written <= 0) {
+            break;
+        }
+        data += written;
+        left -= written;
+    }
+    trace_buffered = 0;
+}
+
+/**
+ * @brief appends a record
+ *
+ * NOTE: trace_lock should be held.
+ */
+static void trace_write (int op, size_t size, size_t alignment, uint32_t id) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = ts.tv_sec * 1000000000UL + ts.tv_nsec;
+    uint64_t delta = trace_last_ns == 0 ? 0 : now - trace_last_ns;
+    trace_last_ns = now;
+
+    uint64_t shift = alignment == 0 ? 0 : __builtin_ctzl(alignment);
+    if (size >> TRACE_SIZE_BITS) {
+        size = (1UL << TRACE_SIZE_BITS) - 1;
+    }
+    trace_buffer[trace_buffered++] = (struct trace_record) {
+        ((shift << 2 | op) << TRACE_SIZE_BITS) | size,
+        id,
+        delta > UINT32_MAX ? UINT32_MAX : (uint32_t) delta
+    };
+    if (trace_buffered == TRACE_BUFFER) {
+        trace_flush();
+    }
+}
+
+/**
+ * @brief stops the running recording
+ *
+ * NOTE: trace_lock should be held.
+ */
+static void trace_close () {
+    if (trace_fd == -1) {
+        return;
+    }
+    __atomic_store_n(&trace_running, 0, __ATOMIC_RELAXED);
+    trace_flush();
+    close(trace_fd);
+    trace_fd = -1;
+    if (trace_table.slots != NULL) {
+        munmap(trace_table.slots, trace_table.capacity * sizeof(struct trace_slot));
+    }
+    trace_table = (struct trace_table) {0};
+}
+
+/* the records are written when the program exits (or the library is unloaded) */
+__attribute__((destructor)) static void trace_exit () {
+    pthread_mutex_lock(&trace_lock);
+    trace_close();
+    pthread_mutex_unlock(&trace_lock);
+}
+
+
+int trace_open(const char *path)
+{
+    pthread_mutex_lock(&trace_lock);
+    trace_close();
+    if (path == NULL) {
+        pthread_mutex_unlock(&trace_lock);
+        return 0;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1 || write(fd, TRACE_MAGIC, TRACE_MAGIC_SIZE) != TRACE_MAGIC_SIZE) {
+        if (fd != -1) {
+            close(fd);
+        }
+        pthread_mutex_unlock(&trace_lock);
+        return -1;
+    }
+    trace_fd = fd;
+    trace_pid = getpid();
+    trace_next_id = 1;
+    trace_last_ns = 0;
+    __atomic_store_n(&trace_running, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&trace_lock);
+    return 0;
+}
+
+
+int trace_active()
+{
+    return __atomic_load_n(&trace_running, __ATOMIC_RELAXED);
+}
+
+
+void trace_alloc(void *ptr, size_t size, size_t alignment)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd != -1) {
+        uint32_t id = trace_next_id++;
+        trace_insert(ptr, id);
+        trace_write(TRACE_MALLOC, size, alignment, id);
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+
+void trace_free(void *ptr)
+{
+    pthread_mutex_lock(&trace_lock);
+    uint32_t id = trace_remove(ptr);
+    if (id != 0 && trace_fd != -1) {
+        trace_write(TRACE_FREE, 0, 0, id);
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+
+uint32_t trace_take(void *ptr)
+{
+    pthread_mutex_lock(&trace_lock);
+    uint32_t id = trace_remove(ptr);
+    pthread_mutex_unlock(&trace_lock);
+    return id;
+}
+
+
+void trace_realloc(uint32_t id, void *old_ptr, void *new_ptr, size_t size)
+{
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd != -1) {
+        if (new_ptr == NULL) {
+            if (id != 0) {
+                trace_insert(old_ptr, id);
+            }
+        } else {
+            if (id == 0) {
+                id = trace_next_id++;
+            }
+            trace_insert(new_ptr, id);
+            trace_write(TRACE_REALLOC, size, 0, id);
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+
+void trace_fork_lock()
+{
+    pthread_mutex_lock(&trace_lock);
+}
+
+
+void trace_fork_unlock(int child)
+{
+    if (child) {
+        pthread_mutex_init(&trace_lock, NULL);
+    } else {
+        pthread_mutex_unlock(&trace_lock);
+    }
+}
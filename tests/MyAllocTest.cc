@@ -3,6 +3,15 @@
 #include <limits.h>
 #include "myalloc.h"
 #include <sys/resource.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <errno.h>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
 
 
 TEST(BuddyMallocTest, ShouldAllocate)
@@ -28,6 +37,48 @@ TEST(BuddyMallocTest, ShouldSplitWhenBigger)
     ASSERT_EQ(c, (void *)((long)a + 64));
 }
 
+TEST(BuddyMallocTest, ShouldUseSmallHeaders)
+{
+    /* 48 bytes of data fit in the smallest block */
+    char *a = (char *) bud_malloc(64 - BUD_BLOCK_SIZE, 1);
+    char *b = (char *) bud_malloc(1, 2);
+    ASSERT_EQ(a + 64, b);
+    ASSERT_EQ(0u, (uintptr_t) a % 16);
+    ASSERT_EQ(a, bud_realloc(a, 1, 0));
+    ASSERT_EQ(64u - BUD_BLOCK_SIZE, bud_usable_size(a));
+    bud_free(a);
+    bud_free(b);
+}
+
+TEST(BuddyMallocTest, ShouldGrowByChunks)
+{
+    ASSERT_EQ(16, bud_set_max_order(16));
+    struct my_heap_stats stats = {};
+    bud_get_stats(&stats);
+    size_t heap_size = stats.heap_size;
+    std::vector<void *> blocks;
+    // the free blocks are used first, then the heap grows a chunk at a time
+    for (size_t i = 0; i < stats.free_bytes / 16384 + 16; i++)
+    {
+        blocks.push_back(bud_malloc(16000, NO_FILL));
+        struct my_heap_stats now = {};
+        bud_get_stats(&now);
+        ASSERT_GE((size_t) 1 << 16, now.heap_size - heap_size);
+        heap_size = now.heap_size;
+    }
+    // a request bigger than a chunk gets a block of its own order
+    char *big = (char *) bud_malloc(1 << 18, 3);
+    ASSERT_NE((char *) NULL, big);
+    ASSERT_EQ(3, big[(1 << 18) - 1]);
+    struct my_heap_stats now = {};
+    bud_get_stats(&now);
+    ASSERT_GT((size_t) 1 << 20, now.heap_size - heap_size);
+    bud_free(big);
+    for (void *block : blocks)
+        bud_free(block);
+    ASSERT_EQ(BUD_MAX_ORDER, bud_set_max_order(BUD_MAX_ORDER));
+}
+
 TEST(BuddyMallocTest, ShouldNullWhenCant)
 {
     struct rlimit lim;
@@ -44,12 +95,47 @@ TEST(BuddyMallocTest, ShouldNullWhenCant)
     ASSERT_FALSE(a == NULL); 
 }
 
+TEST(BuddyMallocTest, ShouldNotWrapHugeSizes)
+{
+    size_t huge = (1UL << 32) + 100;
+    ASSERT_EQ(5L << 30, bud_set_maximum(5L << 30));
+    // it may not fit in the memory, but it should never be a small block
+    char *a = (char *) bud_malloc(huge, NO_FILL);
+    if (a != NULL)
+    {
+        ASSERT_LE(huge, bud_usable_size(a));
+        a[huge - 1] = 1;
+        bud_free(a);
+    }
+    ASSERT_EQ((void *) NULL, bud_malloc((5UL << 30) + 1, NO_FILL));
+    ASSERT_EQ(-1, bud_set_maximum(-1));
+}
+
 TEST(BuddyMallocTest, ShouldFill)
 {
     int* a = (int *)bud_malloc(sizeof(int), 0);
     ASSERT_EQ(0, *a);
 }
 
+TEST(BuddyMallocTest, ShouldAllocateBatch)
+{
+    void *blocks[100];
+    ASSERT_EQ(100u, bud_malloc_batch(40, 100, blocks, 9));
+    for (int i = 0; i < 100; i++)
+    {
+        ASSERT_LE(40u, bud_usable_size(blocks[i]));
+        ASSERT_EQ(9, ((unsigned char *) blocks[i])[39]);
+        if (i > 0)
+        {
+            ASSERT_NE(blocks[i - 1], blocks[i]);
+        }
+    }
+    bud_free_batch(blocks, 100);
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(0u, bud_usable_size(blocks[i]));
+    ASSERT_EQ(0u, bud_malloc_batch((size_t) BUD_MAX_REQUEST + 1, 2, blocks, 0));
+}
+
 TEST(BuddyFreeTest, ShouldFreeMultipleTime)
 {
     for (size_t i = 0; i < 1000; i++)
@@ -69,6 +155,106 @@ TEST(BuddyFreeTest, ShouldCoalesceWhenFree)
 }
 
 
+TEST(BuddyFreeTest, ShouldCoalesceBuddiesInAnyOrder)
+{
+    void *a = bud_malloc(5, 0), *b = bud_malloc(5, 0);
+    void *c = bud_malloc(5, 0), *d = bud_malloc(5, 0);
+    bud_free(c);
+    bud_free(a);
+    bud_free(d);
+    bud_free(b);
+    void *e = bud_malloc(200, 0);
+    ASSERT_EQ(e, a);
+}
+
+TEST(BuddyFreeTest, ShouldFreeSized)
+{
+    void *a = bud_malloc(100, 0);
+    ASSERT_EQ(1, bud_free_sized(a, 100));
+    ASSERT_EQ(0u, bud_usable_size(a));
+    ASSERT_EQ(1, bud_free_sized(a, 100));
+    // the header of an aligned block is not right before it
+    void *b = bud_aligned_alloc(512, 100, 0);
+    ASSERT_EQ(1, bud_free_sized(b, 100));
+    ASSERT_EQ(0u, bud_usable_size(b));
+    // a wrong order is looked up
+    void *c = bud_malloc(1000, 0);
+    ASSERT_EQ(1, bud_free_sized(c, 10));
+    ASSERT_EQ(0u, bud_usable_size(c));
+    int local;
+    ASSERT_EQ(0, bud_free_sized(&local, sizeof(local)));
+}
+
+TEST(BuddyFreeTest, ShouldIgnoreInvalidPointers)
+{
+    int on_stack;
+    char *a = (char *) bud_malloc(100, 0);
+    bud_free(a + 16);
+    bud_free(&on_stack);
+    ASSERT_EQ(bud_realloc(a + 16, 10, 0), (void *) NULL);
+    char *b = (char *) bud_malloc(100, 0);
+    ASSERT_NE(a, b);
+    bud_free(a);
+    bud_free(a);
+    ASSERT_EQ(bud_malloc(100, 0), a);
+    ASSERT_NE(bud_malloc(100, 0), a);
+}
+
+/* number of resident pages in [ptr, ptr + length) (unmapped ones are not) */
+static size_t resident_pages(void *ptr, size_t length)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    char *start = (char *) ((uintptr_t) ptr & ~(page - 1));
+    size_t pages = ((char *) ptr + length - start + page - 1) / page;
+    std::vector<unsigned char> vec(pages);
+    if (mincore(start, pages * page, vec.data()) == -1)
+        return 0;
+    size_t count = 0;
+    for (unsigned char v : vec)
+        count += v & 1;
+    return count;
+}
+
+TEST(BuddyFreeTest, ShouldReleasePagesOfBigFreeBlocks)
+{
+    void *a = bud_malloc(100, 0);
+    char *b = (char *) bud_malloc(4 << 20, 1);
+    void *c = bud_malloc(100, 0);
+    ASSERT_LT((size_t) 1000, resident_pages(b, 4 << 20));
+    bud_free(b);
+    ASSERT_GT((size_t) 2, resident_pages(b + 4096, (4 << 20) - 4096));
+    b = (char *) bud_malloc(4 << 20, 2);
+    ASSERT_EQ(2, b[(4 << 20) - 1]);
+    bud_free(a);
+    bud_free(b);
+    bud_free(c);
+}
+
+TEST(BuddyFreeTest, ShouldKeepPagesWhenReleaseIsDisabled)
+{
+    ASSERT_EQ(-1, bud_set_release_threshold(-1));
+    void *a = bud_malloc(100, 0);
+    char *b = (char *) bud_malloc(4 << 20, 1);
+    bud_free(b);
+    ASSERT_LT((size_t) 1000, resident_pages(b, 4 << 20));
+    bud_free(a);
+}
+
+TEST(BuddyFreeTest, ShouldNotTouchReleasedPagesWhenFilledWithZero)
+{
+    void *a = bud_malloc(100, 0);
+    char *b = (char *) bud_malloc(4 << 20, 1);
+    void *c = bud_malloc(100, 0);
+    bud_free(b);
+    char *d = (char *) bud_malloc(4 << 20, 0);
+    ASSERT_EQ(b, d);
+    ASSERT_GT((size_t) 2, resident_pages(d + 4096, (4 << 20) - 4096));
+    ASSERT_EQ(0, d[(4 << 20) - 1]);
+    bud_free(a);
+    bud_free(c);
+    bud_free(d);
+}
+
 TEST(BuddyReallocTest, ShouldNullIfCant)
 {
     struct rlimit lim;
@@ -108,6 +294,18 @@ TEST(BuddyReallocTest, ShouldSplitIfSmaller)
     ASSERT_EQ((void *)((long) a + 64), b);
 }
 
+TEST(BuddyReallocTest, ShouldGrowInPlace)
+{
+    char *a = (char *) bud_malloc(1000, 1);
+    // the right halves are free after the shrink, they are merged back
+    ASSERT_EQ(a, bud_realloc(a, 100, 0));
+    ASSERT_EQ(a, bud_realloc(a, 900, 2));
+    ASSERT_EQ(1, a[99]);
+    ASSERT_EQ(2, a[899]);
+    ASSERT_EQ(1024u - BUD_BLOCK_SIZE, bud_usable_size(a));
+    bud_free(a);
+}
+
 TEST(BuddyReallocTest, ShouldLimitBoundaries)
 {
     bud_set_minimum(10);
@@ -147,7 +345,23 @@ TEST(FirstfitMallocTest, ShouldSplitWhenBigger)
     ff_free(a);
     void *b = ff_malloc(5, 0), *c = ff_malloc(5, 0);
     ASSERT_EQ(a, b);
-    ASSERT_EQ(c, (void *)((long)a + 45));
+    ASSERT_EQ(c, (void *)((long)a + ff_usable_size(b) + BLOCK_SIZE));
+}
+
+TEST(FirstfitMallocTest, ShouldUseFreeBlockOfSuitableClass)
+{
+    void *blocks[1000];
+    for (int i = 0; i < 1000; i++)
+    {
+        blocks[i] = ff_malloc(32, 0);
+    }
+    void *big = ff_malloc(4096, 0);
+    void *guard = ff_malloc(32, 0);
+    ff_free(blocks[10]);
+    ff_free(big);
+    ASSERT_EQ(ff_malloc(3000, 0), big);
+    ASSERT_EQ(ff_malloc(20, 0), blocks[10]);
+    ASSERT_FALSE(guard == NULL);
 }
 
 TEST(FirstfitMallocTest, ShouldNullWhenCant)
@@ -166,12 +380,50 @@ TEST(FirstfitMallocTest, ShouldNullWhenCant)
     ASSERT_FALSE(a == NULL); 
 }
 
+TEST(FirstfitMallocTest, ShouldNotWrapHugeSizes)
+{
+    size_t huge = (1UL << 32) + 100;
+    ASSERT_EQ(5L << 30, ff_set_maximum(5L << 30));
+    char *a = (char *) ff_malloc(huge, NO_FILL);
+    if (a != NULL)
+    {
+        ASSERT_LE(huge, ff_usable_size(a));
+        a[huge - 1] = 1;
+        ff_free(a);
+    }
+    ASSERT_EQ((void *) NULL, ff_malloc((5UL << 30) + 1, NO_FILL));
+    ASSERT_EQ(-1, ff_set_maximum(-1));
+}
+
 TEST(FirstfitMallocTest, ShouldFill)
 {
     int* a = (int *)ff_malloc(sizeof(int), 0);
     ASSERT_EQ(0, *a);
 }
 
+TEST(FirstfitMallocTest, ShouldAllocateBatch)
+{
+    void *blocks[10];
+    ASSERT_EQ(10u, ff_malloc_batch(100, 10, blocks, 7));
+    for (int i = 0; i < 10; i++)
+    {
+        // carved out of one free block
+        if (i > 0)
+        {
+            ASSERT_EQ((char *) blocks[i - 1] + 112 + BLOCK_SIZE, blocks[i]);
+        }
+        ASSERT_LE(100u, ff_usable_size(blocks[i]));
+        ASSERT_EQ(7, ((unsigned char *) blocks[i])[99]);
+    }
+    ff_free_batch(blocks, 10);
+    for (int i = 0; i < 10; i++)
+        ASSERT_EQ(0u, ff_usable_size(blocks[i]));
+    // the blocks are fused again
+    void *a = ff_malloc(10 * 112, 0);
+    ASSERT_EQ(blocks[0], a);
+    ff_free(a);
+}
+
 TEST(FirstfitFreeTest, ShouldFreeMultipleTime)
 {
     for (size_t i = 0; i < 1000; i++)
@@ -190,6 +442,75 @@ TEST(FirstfitFreeTest, ShouldCoalesceWhenFree)
     ASSERT_EQ(c, a);
 }
 
+TEST(FirstfitFreeTest, ShouldCoalesceWithBothNeighbours)
+{
+    char *a = (char *) ff_malloc(100, 0), *b = (char *) ff_malloc(200, 0);
+    char *c = (char *) ff_malloc(300, 0), *guard = (char *) ff_malloc(10, 0);
+    ASSERT_EQ(b, a + ff_usable_size(a) + BLOCK_SIZE);
+    ASSERT_EQ(c, b + ff_usable_size(b) + BLOCK_SIZE);
+    ff_free(a);
+    ff_free(c);
+    /* b is fused with a (found by its footer) and with c */
+    ff_free(b);
+    size_t fused = guard - BLOCK_SIZE - a;
+    ASSERT_EQ(a, ff_malloc(fused, 1));
+    ASSERT_EQ(fused, ff_usable_size(a));
+    ASSERT_EQ(1, a[fused - 1]);
+    ff_free(guard);
+}
+
+
+TEST(FirstfitFreeTest, ShouldFreeSized)
+{
+    void *a = ff_malloc(100, 0);
+    ASSERT_EQ(1, ff_free_sized(a, 100));
+    ASSERT_EQ(0u, ff_usable_size(a));
+    // double free
+    ASSERT_EQ(1, ff_free_sized(a, 100));
+    void *b = ff_malloc(100, 0);
+    ASSERT_EQ(a, b);
+    ff_free(b);
+    int local;
+    ASSERT_EQ(0, ff_free_sized(&local, sizeof(local)));
+}
+
+TEST(FirstfitFreeTest, ShouldIgnoreInvalidPointers)
+{
+    int on_stack;
+    char *a = (char *) ff_malloc(100, 0);
+    ff_free(a + 16);
+    ff_free(&on_stack);
+    ASSERT_EQ(ff_realloc(a + 16, 10, 0), (void *) NULL);
+    char *b = (char *) ff_malloc(100, 0);
+    ASSERT_NE(a, b);
+    ff_free(a);
+    ff_free(a);
+    ASSERT_EQ(ff_malloc(100, 0), a);
+    ASSERT_NE(ff_malloc(100, 0), a);
+}
+
+TEST(FirstfitMallocTest, ShouldNotFillWithNoFill)
+{
+    char *a = (char *) ff_malloc(1000, 7);
+    void *b = ff_malloc(100, 0);
+    ff_free(a);
+    char *c = (char *) ff_malloc(1000, NO_FILL);
+    ASSERT_EQ(a, c);
+    /* only the links and the footer of the free block were written */
+    ASSERT_EQ(7, c[500]);
+    ff_free(b);
+    ff_free(c);
+}
+
+TEST(FirstfitMallocTest, ShouldZeroFreshMemory)
+{
+    char *a = (char *) ff_malloc(100000, 0);
+    ASSERT_EQ(0, a[99999]);
+    ff_free(a);
+    a = (char *) ff_malloc(100000, 0);
+    ASSERT_EQ(0, a[99999]);
+    ff_free(a);
+}
 
 TEST(FirstfitReallocTest, ShouldNullIfCant)
 {
@@ -227,7 +548,19 @@ TEST(FirstfitReallocTest, ShouldSplitIfSmaller)
     ff_realloc(a, 5, 0);
     // should be in the space of the previous
     void *b = ff_malloc(5, 0);
-    ASSERT_EQ((void *)((long) a + 45), b);
+    ASSERT_EQ((void *)((long) a + ff_usable_size(a) + BLOCK_SIZE), b);
+}
+
+TEST(FirstfitReallocTest, ShouldGrowInPlace)
+{
+    char *a = (char *) ff_malloc(1000, 1);
+    // the free block after the shrunk block is taken back
+    ASSERT_EQ(a, ff_realloc(a, 100, 0));
+    ASSERT_EQ(a, ff_realloc(a, 900, 2));
+    ASSERT_EQ(1, a[99]);
+    ASSERT_EQ(2, a[899]);
+    ASSERT_LE(900u, ff_usable_size(a));
+    ff_free(a);
 }
 
 TEST(FirstfitReallocTest, ShouldLimitBoundaries)
@@ -248,3 +581,764 @@ TEST(FirstfitReallocTest, ShouldLimitBoundaries)
     ASSERT_FALSE(d == NULL);
     ASSERT_FALSE(e == NULL);
 }
+
+TEST(ThreadCacheTest, ShouldReuseFreedBlock)
+{
+    ASSERT_EQ(0, set_slab_limit(0));
+    void *a = my_malloc(96, 0);
+    my_free(a);
+    unsigned char *b = (unsigned char *) my_malloc(90, 7);
+    ASSERT_EQ(a, (void *) b);
+    ASSERT_EQ(7, b[89]);
+}
+
+TEST(ThreadCacheTest, ShouldIgnoreDoubleFree)
+{
+    void *a = my_malloc(100, 0);
+    my_free(a);
+    my_free(a);
+    void *b = my_malloc(100, 0), *c = my_malloc(100, 0);
+    ASSERT_NE(b, c);
+}
+
+/* allocates, checks and frees random blocks, returns false on corruption */
+static bool stress_thread(unsigned seed, int rounds)
+{
+    const int slots = 64;
+    unsigned char *ptrs[slots] = {0};
+    size_t sizes[slots] = {0};
+    bool ok = true;
+    for (int i = 0; i < rounds; i++)
+    {
+        int s = rand_r(&seed) % slots;
+        unsigned char tag = (unsigned char) (seed + s);
+        if (ptrs[s] == NULL)
+        {
+            sizes[s] = 1 + rand_r(&seed) % 2000;
+            ptrs[s] = (unsigned char *) my_malloc(sizes[s], tag);
+            ok = ok && ptrs[s] != NULL;
+            continue;
+        }
+        for (size_t j = 0; j < sizes[s]; j++)
+        {
+            ok = ok && ptrs[s][j] == (unsigned char) (ptrs[s][0]);
+        }
+        if (rand_r(&seed) % 4 == 0)
+        {
+            sizes[s] = 1 + rand_r(&seed) % 2000;
+            ptrs[s] = (unsigned char *) my_realloc(ptrs[s], sizes[s], ptrs[s][0]);
+            ok = ok && ptrs[s] != NULL;
+            if (ptrs[s] != NULL)
+                memset(ptrs[s], ptrs[s][0], sizes[s]);
+        } else {
+            my_free(ptrs[s]);
+            ptrs[s] = NULL;
+        }
+    }
+    for (int s = 0; s < slots; s++)
+    {
+        my_free(ptrs[s]);
+    }
+    return ok;
+}
+
+static bool stress_threads(int count, int rounds)
+{
+    std::atomic<bool> ok(true);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < count; i++)
+    {
+        threads.emplace_back([&ok, i, rounds]() {
+            if (!stress_thread(i + 1, rounds))
+                ok = false;
+        });
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    return ok;
+}
+
+TEST(ThreadSafetyTest, FirstfitShouldWorkWithManyThreads)
+{
+    ASSERT_EQ(1, set_algorithm("firstfit"));
+    ASSERT_TRUE(stress_threads(8, 20000));
+}
+
+TEST(ThreadSafetyTest, BuddyShouldWorkWithManyThreads)
+{
+    ASSERT_EQ(2, set_algorithm("buddy"));
+    ASSERT_TRUE(stress_threads(8, 20000));
+}
+
+TEST(ArenaTest, ShouldNotChangeAfterUse)
+{
+    ASSERT_EQ(3, set_arenas(3));
+    void *a = my_malloc(1000, 0);
+    ASSERT_EQ(-1, set_arenas(2));
+    ASSERT_EQ(EMLINK, errno);
+    my_free(a);
+}
+
+TEST(ArenaTest, ShouldFreeBlocksOfOtherArenas)
+{
+    ASSERT_EQ(4, set_arenas(4));
+    void *blocks[4];
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++)
+    {
+        threads.emplace_back([&blocks, i]() { blocks[i] = ff_malloc(4992, 0); });
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        ASSERT_EQ(4992u, ff_usable_size(blocks[i]));
+        ff_free(blocks[i]);
+        ASSERT_EQ(0u, ff_usable_size(blocks[i]));
+    }
+}
+
+TEST(MappedTest, ShouldMapLargeRequests)
+{
+    unsigned char *a = (unsigned char *) my_malloc(1 << 20, 3);
+    ASSERT_NE(a, (void *) NULL);
+    ASSERT_EQ(0u, ff_usable_size(a));
+    ASSERT_LE((size_t) 1 << 20, map_usable_size(a));
+    ASSERT_EQ(3, a[0]);
+    ASSERT_EQ(3, a[(1 << 20) - 1]);
+    my_free(a);
+    ASSERT_EQ(0u, map_usable_size(a));
+    my_free(a);
+}
+
+TEST(MappedTest, ShouldNotMapWhenDisabled)
+{
+    ASSERT_EQ(-1, set_mmap_threshold(-1));
+    void *a = my_malloc(1 << 20, 0);
+    ASSERT_EQ((size_t) 1 << 20, ff_usable_size(a));
+    ASSERT_EQ(0u, map_usable_size(a));
+    my_free(a);
+}
+
+TEST(MappedTest, ShouldReallocMappedBlocks)
+{
+    ASSERT_EQ(2, set_algorithm("buddy"));
+    unsigned char *a = (unsigned char *) my_malloc(200000, 5);
+    unsigned char *b = (unsigned char *) my_realloc(a, 400000, 6);
+    ASSERT_NE(b, (void *) NULL);
+    if (b != a)
+    {
+        ASSERT_EQ(0u, map_usable_size(a));
+    }
+    ASSERT_EQ(5, b[199999]);
+    ASSERT_EQ(6, b[200000]);
+    unsigned char *c = (unsigned char *) my_realloc(b, 100, 0);
+    ASSERT_EQ(0u, map_usable_size(b));
+    ASSERT_LE(100u, my_usable_size(c));
+    ASSERT_EQ(5, c[99]);
+    my_free(c);
+}
+
+TEST(MappedTest, ShouldRemapGrowingBlocks)
+{
+    unsigned char *a = (unsigned char *) my_malloc(1000, 1);
+    // a block which grows out of the heap is mapped
+    a = (unsigned char *) my_realloc(a, 1 << 20, 2);
+    ASSERT_LE((size_t) 1 << 20, map_usable_size(a));
+    ASSERT_EQ(1, a[999]);
+    ASSERT_EQ(2, a[(1 << 20) - 1]);
+    unsigned char *b = (unsigned char *) my_realloc(a, 64 << 20, 0);
+    ASSERT_LE((size_t) 64 << 20, map_usable_size(b));
+    ASSERT_EQ(1, b[999]);
+    ASSERT_EQ(2, b[(1 << 20) - 1]);
+    // the new pages are zero, they are not touched by a zero fill
+    ASSERT_GT((size_t) 16, resident_pages(b + (2 << 20), 60 << 20));
+    ASSERT_EQ(0, b[(64 << 20) - 1]);
+    b = (unsigned char *) my_realloc(b, 2 << 20, 0);
+    ASSERT_EQ(2, b[(1 << 20) - 1]);
+    my_free(b);
+    ASSERT_EQ(0u, map_usable_size(b));
+}
+
+TEST(AlignedAllocTest, FirstfitShouldAlignAndReusePadding)
+{
+    void *first = ff_malloc(10, 0);
+    unsigned char *a = (unsigned char *) ff_aligned_alloc(4096, 100, 7);
+    ASSERT_EQ(0u, (uintptr_t) a % 4096);
+    ASSERT_EQ(7, a[99]);
+    /* sizes are rounded to FF_ALIGN */
+    ASSERT_EQ(112u, ff_usable_size(a));
+    /* the padding before a is a free block */
+    void *b = ff_malloc(1000, 0);
+    ASSERT_LT(b, (void *) a);
+    ff_free(a);
+    ASSERT_EQ(0u, ff_usable_size(a));
+    ff_free(b);
+    ff_free(first);
+}
+
+TEST(AlignedAllocTest, BuddyShouldAlign)
+{
+    void *first = bud_malloc(10, 0);
+    for (size_t alignment = 16; alignment <= 16384; alignment *= 2)
+    {
+        unsigned char *a = (unsigned char *) bud_aligned_alloc(alignment, 100, 3);
+        ASSERT_EQ(0u, (uintptr_t) a % alignment);
+        ASSERT_LE(100u, bud_usable_size(a));
+        ASSERT_EQ(3, a[99]);
+        unsigned char *b = (unsigned char *) bud_realloc(a, 1000, 4);
+        ASSERT_EQ(3, b[99]);
+        ASSERT_EQ(0u, bud_usable_size(a == b ? NULL : a));
+        bud_free(b);
+        ASSERT_EQ(0u, bud_usable_size(b));
+    }
+    bud_free(first);
+}
+
+TEST(AlignedAllocTest, ShouldRejectInvalidAlignment)
+{
+    ASSERT_EQ((void *) NULL, my_aligned_alloc(24, 100, 0));
+    ASSERT_EQ(EINVAL, errno);
+    ASSERT_EQ((void *) NULL, ff_aligned_alloc(0, 100, 0));
+    ASSERT_EQ((void *) NULL, bud_aligned_alloc(48, 100, 0));
+}
+
+TEST(AlignedAllocTest, ShouldMapLargeAlignedRequests)
+{
+    void *a = my_aligned_alloc(65536, 1 << 20, 0);
+    ASSERT_EQ(0u, (uintptr_t) a % 65536);
+    ASSERT_LE((size_t) 1 << 20, map_usable_size(a));
+    my_free(a);
+    ASSERT_EQ(0u, map_usable_size(a));
+}
+
+TEST(ForkTest, ShouldAllocateInChildWhileThreadsAllocate)
+{
+    ASSERT_EQ(0, pthread_atfork(&my_fork_prepare, &my_fork_parent, &my_fork_child));
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 2; t++)
+    {
+        threads.emplace_back([&stop]() {
+            size_t sizes[] = {5000, 200000, 3000};
+            for (unsigned i = 0; !stop; i++)
+                my_free(my_malloc(sizes[i % 3], 0));
+        });
+    }
+    int failed = 0;
+    for (int i = 0; i < 200; i++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            // a lock which was held at the time of fork would hang the child
+            alarm(5);
+            my_free(my_malloc(5000, 0));
+            my_free(my_malloc(200000, 0));
+            _exit(0);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    stop = true;
+    for (std::thread &thread : threads)
+        thread.join();
+    ASSERT_EQ(0, failed);
+}
+
+/* allocates from the C library between the allocations, which moves the program break */
+static void check_next_to_libc_malloc(const char *algorithm)
+{
+    ASSERT_NE(-1, set_algorithm(algorithm));
+    std::vector<void *> ours, theirs;
+    for (int i = 0; i < 2000; i++)
+    {
+        theirs.push_back(malloc(1000));
+        void *ptr = my_malloc(1000, 0);
+        ASSERT_NE(nullptr, ptr);
+        ours.push_back(ptr);
+    }
+    for (size_t i = 0; i < ours.size(); i++)
+    {
+        my_free(ours[i]);
+        free(theirs[i]);
+    }
+}
+
+TEST(ArenaTest, FirstfitShouldGrowNextToLibcMalloc)
+{
+    check_next_to_libc_malloc("firstfit");
+}
+
+TEST(ArenaTest, BuddyShouldGrowNextToLibcMalloc)
+{
+    check_next_to_libc_malloc("buddy");
+}
+
+/* runs a pipeline with the preloaded library and returns its output */
+static std::string run_preloaded(const char *algorithm, const char *command)
+{
+    std::string line = std::string("MYALLOC_ALGORITHM=") + algorithm + " LD_PRELOAD=" + MYALLOC_PRELOAD
+                       + " sh -c '" + command + "'";
+    FILE *pipe = popen(line.c_str(), "r");
+    std::string output;
+    char buffer[256];
+    while (pipe != NULL && fgets(buffer, sizeof(buffer), pipe) != NULL)
+    {
+        output += buffer;
+    }
+    if (pipe == NULL || pclose(pipe) != 0)
+    {
+        return "failed";
+    }
+    return output;
+}
+
+TEST(PreloadTest, ShouldRunProgramsWithFirstfit)
+{
+    ASSERT_EQ("200000\n", run_preloaded("firstfit", "seq 200000 | sort -rn | head -n 1"));
+}
+
+TEST(PreloadTest, ShouldRunProgramsWithBuddy)
+{
+    ASSERT_EQ("200000\n", run_preloaded("buddy", "seq 200000 | sort -rn | head -n 1"));
+}
+
+/* a thread allocates a block, the main thread frees it remotely and the
+   next allocation of the thread should get it back from the queue */
+static void remote_free_reuse(void *(*alloc)(size_t, int), size_t (*usable_size)(void *),
+                              void (*release)(void *))
+{
+    ASSERT_EQ(2, set_arenas(2));
+    void *own = alloc(10, 0);
+    std::atomic<void *> block(nullptr), reused(nullptr);
+    std::atomic<bool> freed(false);
+    std::thread owner([&]() {
+        block = alloc(5000, 0);
+        while (!freed)
+        {
+            std::this_thread::yield();
+        }
+        reused = alloc(5000, 0);
+    });
+    while (block == nullptr)
+    {
+        std::this_thread::yield();
+    }
+    ASSERT_NE(0u, usable_size(block));
+    release(block);
+    ASSERT_EQ(0u, usable_size(block));
+    freed = true;
+    owner.join();
+    ASSERT_EQ(block, reused);
+    release(own);
+}
+
+TEST(ArenaTest, FirstfitShouldReuseRemotelyFreedBlock)
+{
+    remote_free_reuse(ff_malloc, ff_usable_size, ff_free);
+}
+
+TEST(ArenaTest, BuddyShouldReuseRemotelyFreedBlock)
+{
+    remote_free_reuse(bud_malloc, bud_usable_size, bud_free);
+}
+
+TEST(ArenaTest, FirstfitShouldWorkWithManyArenas)
+{
+    ASSERT_EQ(1, set_algorithm("firstfit"));
+    ASSERT_EQ(4, set_arenas(4));
+    ASSERT_TRUE(stress_threads(8, 20000));
+}
+
+TEST(ArenaTest, BuddyShouldWorkWithManyArenas)
+{
+    ASSERT_EQ(2, set_algorithm("buddy"));
+    ASSERT_EQ(4, set_arenas(4));
+    ASSERT_TRUE(stress_threads(8, 20000));
+}
+
+TEST(TraceTest, ShouldRecordAllocations)
+{
+    char path[] = "/tmp/myalloc-trace-XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(-1, fd);
+    close(fd);
+
+    void *unknown = my_malloc(10, 0);
+    ASSERT_EQ(0, set_trace(path));
+    void *a = my_malloc(100, 0);
+    void *b = my_aligned_alloc(64, 50, 0);
+    a = my_realloc(a, 200, 0);
+    my_free(b);
+    my_free(unknown);
+    my_free(a);
+    ASSERT_EQ(0, set_trace(NULL));
+
+    FILE *file = fopen(path, "rb");
+    char magic[TRACE_MAGIC_SIZE];
+    struct trace_record records[6];
+    ASSERT_EQ(1u, fread(magic, TRACE_MAGIC_SIZE, 1, file));
+    ASSERT_EQ(0, memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE));
+    ASSERT_EQ(5u, fread(records, sizeof(records[0]), 6, file));
+    fclose(file);
+    unlink(path);
+
+    int ops[] = {TRACE_MALLOC, TRACE_MALLOC, TRACE_REALLOC, TRACE_FREE, TRACE_FREE};
+    uint32_t ids[] = {1, 2, 1, 2, 1};
+    size_t sizes[] = {100, 50, 200, 0, 0};
+    for (int i = 0; i < 5; i++)
+    {
+        ASSERT_EQ(ops[i], TRACE_OP(&records[i]));
+        ASSERT_EQ(ids[i], records[i].id);
+        ASSERT_EQ(sizes[i], TRACE_REQUEST(&records[i]));
+    }
+    ASSERT_EQ(6, TRACE_ALIGN_SHIFT(&records[1]));
+    ASSERT_EQ(0, TRACE_ALIGN_SHIFT(&records[0]));
+}
+
+static void check_stats(const char *algorithm, size_t block_size)
+{
+    ASSERT_NE(-1, set_algorithm(algorithm));
+    struct my_heap_stats before, stats;
+    my_get_stats(&before);
+
+    void *a = my_malloc(5000, 0);
+    void *m = my_malloc(1 << 20, 0);
+    my_get_stats(&stats);
+    ASSERT_EQ(before.in_use_blocks + 1, stats.in_use_blocks);
+    ASSERT_EQ(before.requested_bytes + 5000, stats.requested_bytes);
+    ASSERT_EQ(before.in_use_bytes + block_size, stats.in_use_bytes);
+    ASSERT_EQ(stats.in_use_bytes - stats.requested_bytes, stats.internal_fragmentation);
+    ASSERT_EQ(stats.heap_size - stats.in_use_bytes - stats.free_bytes, stats.metadata_bytes);
+    ASSERT_NE(nullptr, stats.heap_top);
+    ASSERT_EQ(1u, stats.mapped_blocks);
+    ASSERT_LE((size_t) 1 << 20, stats.mapped_bytes);
+
+    my_free(a);
+    my_free(m);
+    my_get_stats(&stats);
+    ASSERT_EQ(before.in_use_blocks, stats.in_use_blocks);
+    ASSERT_EQ(before.requested_bytes, stats.requested_bytes);
+    ASSERT_LE(block_size, stats.largest_free_block);
+    ASSERT_LE(stats.largest_free_block, stats.free_bytes);
+    ASSERT_EQ(0u, stats.mapped_blocks);
+}
+
+TEST(StatsTest, FirstfitShouldCountBlocks)
+{
+    /* sizes are rounded to FF_ALIGN */
+    check_stats("firstfit", 5008);
+}
+
+TEST(StatsTest, BuddyShouldCountBlocks)
+{
+    check_stats("buddy", 8192 - BUD_BLOCK_SIZE);
+}
+
+static size_t ff_largest_free_block()
+{
+    struct my_heap_stats stats = {};
+    ff_get_stats(&stats);
+    return stats.largest_free_block;
+}
+
+TEST(StatsTest, FirstfitShouldTrackLargestFreeBlock)
+{
+    void *a = ff_malloc(60000, 0), *b = ff_malloc(100, 0);
+    void *c = ff_malloc(50000, 0), *d = ff_malloc(100, 0);
+    ASSERT_EQ(0u, ff_largest_free_block());
+    ff_free(a);
+    ff_free(c);
+    ASSERT_EQ(60000u, ff_largest_free_block());
+    // the largest block of the class is taken, the next one is found
+    ASSERT_EQ(a, ff_malloc(60000, 0));
+    ASSERT_EQ(50000u, ff_largest_free_block());
+    ff_free(a);
+    ASSERT_EQ(60000u, ff_largest_free_block());
+    ff_free(b);
+    ff_free(d);
+}
+
+/* frees blocks of 3000 and 2100 bytes (the 3000 one is lower and is freed last) */
+static void free_two_blocks(void **low, void **high)
+{
+    *low = my_malloc(3000, 0);
+    void *gap = my_malloc(2000, 0);
+    *high = my_malloc(2100, 0);
+    my_malloc(2000, 0);
+    my_free(*high);
+    my_free(*low);
+    (void) gap;
+}
+
+TEST(PolicyTest, FirstfitShouldTakeLastFreedBlock)
+{
+    ASSERT_EQ(1, set_algorithm("firstfit"));
+    void *low, *high;
+    free_two_blocks(&low, &high);
+    ASSERT_EQ(low, my_malloc(2050, 0));
+}
+
+TEST(PolicyTest, BestfitShouldTakeSmallestBlock)
+{
+    ASSERT_EQ(3, set_algorithm("bestfit"));
+    void *low, *high;
+    free_two_blocks(&low, &high);
+    ASSERT_EQ(high, my_malloc(2050, 0));
+}
+
+TEST(PolicyTest, AddressfitShouldTakeLowestBlock)
+{
+    ASSERT_EQ(5, set_algorithm("addressfit"));
+    void *low = my_malloc(3000, 0);
+    my_malloc(2000, 0);
+    void *high = my_malloc(2100, 0);
+    my_malloc(2000, 0);
+    my_free(low);
+    my_free(high);
+    ASSERT_EQ(low, my_malloc(2050, 0));
+}
+
+TEST(PolicyTest, NextfitShouldMoveTheRover)
+{
+    ASSERT_EQ(4, set_algorithm("nextfit"));
+    void *a = my_malloc(3000, 0);
+    my_malloc(2000, 0);
+    void *b = my_malloc(3000, 0);
+    my_malloc(2000, 0);
+    my_free(a);
+    my_free(b);
+    ASSERT_EQ(b, my_malloc(3000, 0));
+    my_free(b);
+    /* first fit would take b again */
+    ASSERT_EQ(a, my_malloc(3000, 0));
+}
+
+TEST(PolicyTest, PoliciesShouldWorkWithManyThreads)
+{
+    ASSERT_EQ(3, set_algorithm("bestfit"));
+    ASSERT_TRUE(stress_threads(4, 20000));
+}
+
+TEST(SlabTest, ShouldPackSmallObjects)
+{
+    unsigned char *a = (unsigned char *) my_malloc(20, 3);
+    unsigned char *b = (unsigned char *) my_malloc(20, 4);
+    ASSERT_EQ(32u, slab_usable_size(a));
+    ASSERT_EQ(32u, my_usable_size(a));
+    ASSERT_EQ(a + 32, b);
+    ASSERT_EQ(0u, (uintptr_t) a % SLAB_GRANULE);
+    ASSERT_EQ(3, a[19]);
+    ASSERT_EQ(4, b[19]);
+    /* not an object boundary */
+    ASSERT_EQ(0u, ff_usable_size(a));
+    slab_free(a + 8);
+    struct my_heap_stats stats;
+    my_get_stats(&stats);
+    ASSERT_EQ(2u, stats.slab_objects);
+    ASSERT_EQ((size_t) SLAB_SIZE, stats.slab_bytes);
+    my_free(a);
+    my_free(b);
+}
+
+TEST(SlabTest, ShouldIgnoreDoubleFree)
+{
+    void *a = slab_alloc(50, 0);
+    void *b = slab_alloc(50, 0);
+    slab_free(a);
+    slab_free(a);
+    struct my_heap_stats stats = {};
+    slab_get_stats(&stats);
+    ASSERT_EQ(1u, stats.slab_objects);
+    ASSERT_EQ(a, slab_alloc(50, NO_FILL));
+    ASSERT_NE(b, slab_alloc(50, NO_FILL));
+}
+
+TEST(SlabTest, ShouldIgnoreInteriorPointers)
+{
+    unsigned char *a = (unsigned char *) my_malloc(32, 0);
+    ASSERT_EQ(0u, my_usable_size(a + 16));
+    my_free(a + 16);
+    unsigned char *b = (unsigned char *) my_malloc(32, 0);
+    ASSERT_NE(a + 16, b);
+    ASSERT_NE(a, b);
+    my_free(a);
+    my_free(b);
+}
+
+TEST(SlabTest, ShouldIgnoreStaleDoubleFree)
+{
+    // the last object does not fit in the thread cache, it goes back to its slab
+    void *blocks[TC_BIN_COUNT + 2];
+    for (int i = 0; i <= TC_BIN_COUNT; i++)
+        blocks[i] = my_malloc(32, 0);
+    for (int i = 0; i <= TC_BIN_COUNT; i++)
+        my_free(blocks[i]);
+    ASSERT_EQ(0u, my_usable_size(blocks[TC_BIN_COUNT]));
+    my_free(blocks[TC_BIN_COUNT]);
+    for (int i = 0; i < TC_BIN_COUNT + 2; i++)
+    {
+        blocks[i] = my_malloc(32, 0);
+        for (int j = 0; j < i; j++)
+            ASSERT_NE(blocks[j], blocks[i]);
+    }
+}
+
+TEST(SlabTest, ShouldGiveEmptySlabsBack)
+{
+    std::vector<void *> objects;
+    for (int i = 0; i < 1000; i++)
+    {
+        objects.push_back(slab_alloc(64, 1));
+        ASSERT_NE(objects.back(), (void *) NULL);
+    }
+    struct my_heap_stats full = {};
+    slab_get_stats(&full);
+    ASSERT_LE((size_t) 1000 * 64, full.slab_bytes);
+    for (void *ptr : objects)
+    {
+        slab_free(ptr);
+    }
+    struct my_heap_stats empty = {};
+    slab_get_stats(&empty);
+    ASSERT_EQ(0u, empty.slab_objects);
+    /* only one empty slab is kept */
+    ASSERT_EQ((size_t) SLAB_SIZE, empty.slab_bytes);
+    /* the slabs given back are zero again and are reused by other classes */
+    unsigned char *a = (unsigned char *) slab_alloc(200, NO_FILL);
+    ASSERT_EQ(0, a[199]);
+    struct my_heap_stats reused = {};
+    slab_get_stats(&reused);
+    ASSERT_EQ((size_t) 2 * SLAB_SIZE, reused.slab_bytes);
+}
+
+TEST(SlabTest, ShouldBeDisabledByLimit)
+{
+    ASSERT_EQ(SLAB_MAX_SIZE, set_slab_limit(100000));
+    ASSERT_EQ(0, set_slab_limit(0));
+    void *a = my_malloc(20, 0);
+    ASSERT_EQ(0u, slab_usable_size(a));
+    ASSERT_LE(20u, ff_usable_size(a));
+    my_free(a);
+}
+
+TEST(SlabTest, ShouldMoveOutOfSlabsOnRealloc)
+{
+    ASSERT_EQ(2, set_algorithm("buddy"));
+    unsigned char *a = (unsigned char *) my_malloc(100, 9);
+    ASSERT_EQ(112u, slab_usable_size(a));
+    ASSERT_EQ(a, my_realloc(a, 110, 9));
+    unsigned char *b = (unsigned char *) my_realloc(a, 1000, 8);
+    ASSERT_EQ(0u, slab_usable_size(b));
+    ASSERT_LE(1000u, bud_usable_size(b));
+    ASSERT_EQ(9, b[99]);
+    ASSERT_EQ(8, b[999]);
+    my_free(b);
+}
+
+TEST(SlabTest, ShouldWorkWithManyThreads)
+{
+    ASSERT_EQ((long) SLAB_MAX_SIZE, set_slab_limit(SLAB_MAX_SIZE));
+    std::vector<void *> shared(4096);
+    std::atomic<bool> ok(true);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&shared, &ok, t]() {
+            unsigned seed = t + 1;
+            for (int i = 0; i < 50000; i++)
+            {
+                size_t slot = rand_r(&seed) % shared.size();
+                void *ptr = __atomic_exchange_n(&shared[slot], (void *) NULL, __ATOMIC_ACQ_REL);
+                if (ptr != NULL)
+                {
+                    unsigned char *p = (unsigned char *) ptr;
+                    size_t size = my_usable_size(p);
+                    ok = ok && size != 0 && p[0] == p[size - 1];
+                    my_free(ptr);
+                } else {
+                    size_t size = 1 + rand_r(&seed) % SLAB_MAX_SIZE;
+                    unsigned char *p = (unsigned char *) my_malloc(size, 0);
+                    ok = ok && p != NULL;
+                    memset(p, (int) slot, my_usable_size(p));
+                    ptr = __atomic_exchange_n(&shared[slot], (void *) p, __ATOMIC_ACQ_REL);
+                    if (ptr != NULL)
+                        my_free(ptr);
+                }
+            }
+        });
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    ASSERT_TRUE(ok);
+    for (void *ptr : shared)
+    {
+        my_free(ptr);
+    }
+}
+
+TEST(BatchTest, ShouldAllocateAndFreeEverySize)
+{
+    size_t sizes[] = {16, 1000, 1 << 20};
+    for (size_t size : sizes)
+    {
+        void *blocks[70];
+        ASSERT_EQ(70u, my_malloc_batch(size, 70, blocks, 4));
+        for (int i = 0; i < 70; i++)
+        {
+            ASSERT_LE(size, my_usable_size(blocks[i]));
+            ASSERT_EQ(4, ((unsigned char *) blocks[i])[size - 1]);
+        }
+        my_free_batch(blocks, 70);
+        for (int i = 0; i < 70; i++)
+            ASSERT_EQ(0u, my_usable_size(blocks[i]));
+    }
+    void *mixed[] = {my_malloc(16, 0), NULL, my_malloc(1000, 0), my_malloc(1 << 20, 0)};
+    my_free_batch(mixed, 4);
+    ASSERT_EQ(0u, my_usable_size(mixed[3]));
+}
+
+TEST(FreeSizedTest, ShouldFreeEverySize)
+{
+    ASSERT_EQ(2, set_algorithm("buddy"));
+    // slab objects and small blocks are cached
+    void *a = my_malloc(20, 0);
+    my_free_sized(a, 20);
+    ASSERT_EQ(a, my_malloc(20, 0));
+    void *b = my_malloc(1000, 0);
+    my_free_sized(b, 1000);
+    ASSERT_EQ(b, my_malloc(1000, 0));
+    void *c = my_malloc(5000, 0);
+    my_free_sized(c, 5000);
+    ASSERT_EQ(0u, my_usable_size(c));
+    void *d = my_malloc(1 << 20, 0);
+    my_free_sized(d, 1 << 20);
+    ASSERT_EQ(0u, map_usable_size(d));
+    my_free(a);
+    my_free(b);
+}
+
+TEST(FreeSizedTest, ShouldFreeMappedBlocksAfterThresholdChange)
+{
+    void *a = my_malloc(1 << 20, 0);
+    ASSERT_EQ(-1, set_mmap_threshold(-1));
+    my_free_sized(a, 1 << 20);
+    ASSERT_EQ(0u, map_usable_size(a));
+}
+
+TEST(FreeSizedTest, ShouldCheckSizeInDebugMode)
+{
+    void *a = my_malloc(1000, 0);
+    ASSERT_EQ(1, set_debug(1));
+    EXPECT_DEATH(my_free_sized(a, 2000), "my_free_sized");
+    my_free_sized(a, 1000);
+    ASSERT_EQ(0, set_debug(0));
+}